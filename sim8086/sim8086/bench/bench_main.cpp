@@ -0,0 +1,467 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include "Sim8086.h"
+
+#ifndef SIM_TESTS_DIR
+#define SIM_TESTS_DIR "tests"
+#endif
+
+#ifndef SIM_PERF_TEST
+#define SIM_PERF_TEST "tests/mov_perf_tst.bin"
+#endif
+
+#define CORPUS_SIZE (60 * 1024)     // Keeps the whole corpus inside one 64 KiB segment
+#define BENCH_PASSES 200
+#define LISTING_COPIES 40           // Decoded listings this many corpora long are far bigger than any cache
+#define LISTING_PASSES 5
+#define FAMILY_STREAM_SIZE MEMORY_SIZE    // One generated stream fills the address space
+#define STAGE_PASSES 3
+#define EXECUTION_PASSES 20
+
+struct CorpusInstruction {
+    uint16_t offset;
+    uint8_t entry;
+};
+
+static std::vector<CorpusInstruction> Corpus;
+static Machine Sim = {};
+
+/**
+ * Fills the machine's memory with the fixture binaries repeated back to back and records where every instruction starts, so the
+ * timed loops only measure decoding.
+ */
+uint32_t LoadCorpus(const char *directory)
+{
+    std::vector<std::filesystem::path> files;
+    for (const auto &file : std::filesystem::directory_iterator(directory))
+    {
+        if (file.path().extension() == ".bin")
+        {
+            files.push_back(file.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    std::vector<std::vector<char>> images;
+    for (const auto &path : files)
+    {
+        std::ifstream file(path, std::ios::binary);
+        images.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    uint32_t used = 0;
+    for (size_t i = 0; !images.empty(); i = (i + 1) % images.size())
+    {
+        if (used + images[i].size() > CORPUS_SIZE)
+        {
+            break;
+        }
+
+        std::copy(images[i].begin(), images[i].end(), Sim.memory + used);
+        used += (uint32_t)images[i].size();
+    }
+
+    SegmentedAddress at = Create(0, 0);
+    while (at.offset < used)
+    {
+        uint8_t entry = LookupEntry(Sim, at);
+        if (entry == NO_ENTRY)
+        {
+            IncrementAddress(at);
+            continue;
+        }
+
+        uint16_t offset = at.offset;
+        SpecializedDecoders[entry](Sim, at);
+        Corpus.push_back({ .offset = offset, .entry = entry });
+    }
+
+    return used;
+}
+
+template <typename DecodeFunction>
+double TimeDecoder(const char *name, DecodeFunction decode)
+{
+    uint64_t checksum = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < BENCH_PASSES; pass++)
+    {
+        for (const CorpusInstruction &inst : Corpus)
+        {
+            SegmentedAddress at = Create(0, inst.offset);
+            Instruction result = decode(inst.entry, at);
+            checksum += result.op + at.offset + result.operands[SRC].type;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double count = (double)Corpus.size() * BENCH_PASSES;
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count() / count;
+    printf("%-14s %8.2f ns/inst %10.2f Minst/s  (checksum %llu)\n", name, ns, 1000.0 / ns, (unsigned long long)checksum);
+    return ns;
+}
+
+/**
+ * Linear sweep over the whole corpus, advancing by whatever size `step` reports for the instruction at the cursor.
+ */
+template <typename StepFunction>
+double TimeScan(const char *name, uint32_t bytes, StepFunction step)
+{
+    uint64_t instructions = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < BENCH_PASSES; pass++)
+    {
+        SegmentedAddress at = Create(0, 0);
+        while (at.offset < bytes)
+        {
+            uint8_t size = step(at);
+            at.offset += (size == 0) ? 1 : size;
+            instructions++;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count() / (double)instructions;
+    printf("%-14s %8.2f ns/inst %10.2f Minst/s\n", name, ns, 1000.0 / ns);
+    return ns;
+}
+
+/**
+ * The same sweep split in two: the length at every byte is scanned first with independent lookups, then the sweep only
+ * steps through those lengths.
+ */
+double TimeBatchedScan(const char *name, uint32_t bytes)
+{
+    std::vector<uint8_t> lengths(bytes);
+    uint64_t instructions = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < BENCH_PASSES; pass++)
+    {
+        ScanInstructionLengths(Sim.memory, bytes, lengths.data());
+        for (uint32_t offset = 0; offset < bytes; offset += lengths[offset])
+        {
+            instructions++;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count() / (double)instructions;
+    printf("%-14s %8.2f ns/inst %10.2f Minst/s\n", name, ns, 1000.0 / ns);
+    return ns;
+}
+
+/**
+ * Decodes the corpus LISTING_COPIES times into one listing of `Stored` entries, then reads every entry back as an
+ * Instruction, the way the formatter consumes the decode ring.
+ */
+template <typename Stored, typename StoreFunction, typename LoadFunction>
+void TimeListing(const char *name, StoreFunction store, LoadFunction load)
+{
+    std::vector<Stored> listing;
+    listing.reserve(Corpus.size() * LISTING_COPIES);
+    uint64_t checksum = 0;
+    double buildNs = 0;
+    double readNs = 0;
+
+    for (int pass = 0; pass < LISTING_PASSES; pass++)
+    {
+        listing.clear();
+
+        auto begin = std::chrono::steady_clock::now();
+        for (int copy = 0; copy < LISTING_COPIES; copy++)
+        {
+            for (const CorpusInstruction &inst : Corpus)
+            {
+                SegmentedAddress at = Create(0, inst.offset);
+                listing.push_back(store(SpecializedDecoders[inst.entry](Sim, at)));
+            }
+        }
+        auto built = std::chrono::steady_clock::now();
+
+        for (const Stored &stored : listing)
+        {
+            Instruction inst = load(stored);
+            checksum += inst.op + inst.size + inst.operands[SRC].immediate + inst.operands[DEST].type;
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        buildNs += std::chrono::duration<double, std::nano>(built - begin).count();
+        readNs += std::chrono::duration<double, std::nano>(end - built).count();
+    }
+
+    double count = (double)listing.size() * LISTING_PASSES;
+    double mib = (double)(listing.size() * sizeof(Stored)) / (1024.0 * 1024.0);
+    printf("%-14s %3zu B/inst %7.1f MiB  decode+store %6.2f ns/inst  read %6.2f ns/inst  (checksum %llu)\n",
+        name, sizeof(Stored), mib, buildNs / count, readNs / count, (unsigned long long)checksum);
+}
+
+inline SegmentedAddress StreamAddress(uint32_t address)
+{
+    return Create(address >> 4, address & 0xF);
+}
+
+/**
+ * Fills memory with one image repeated back to back up to CORPUS_SIZE and returns where its instructions start. Empty if
+ * the image can't be read.
+ */
+std::vector<GeneratedInstruction> LoadImageStream(const char *path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::vector<GeneratedInstruction> stream;
+    if (image.empty())
+    {
+        return stream;
+    }
+
+    uint32_t used = 0;
+    while (used + image.size() <= CORPUS_SIZE)
+    {
+        std::copy(image.begin(), image.end(), Sim.memory + used);
+        used += (uint32_t)image.size();
+    }
+
+    SegmentedAddress at = Create(0, 0);
+    while (at.offset < used)
+    {
+        uint8_t entry = LookupEntry(Sim, at);
+        if (entry == NO_ENTRY)
+        {
+            IncrementAddress(at);
+            continue;
+        }
+
+        uint32_t address = at.offset;
+        SpecializedDecoders[entry](Sim, at);
+        stream.push_back({ .address = address, .entry = entry });
+    }
+
+    return stream;
+}
+
+/**
+ * Times the three stages of turning bytes into a listing separately: selecting the table entry, decoding the operands
+ * with the entry's specialized decoder, and formatting the decoded instruction.
+ */
+void TimeStages(const char *name, const std::vector<GeneratedInstruction> &stream)
+{
+    std::vector<Instruction> decoded(stream.size());
+    std::string listing;
+    std::unique_ptr<OutputWriter> writer = std::make_unique<OutputWriter>();
+    uint64_t checksum = 0;
+    double lookupNs = 0;
+    double decodeNs = 0;
+    double formatNs = 0;
+
+    for (int pass = 0; pass < STAGE_PASSES; pass++)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        for (const GeneratedInstruction &inst : stream)
+        {
+            checksum += LookupEntry(Sim, StreamAddress(inst.address));
+        }
+        auto looked = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < stream.size(); i++)
+        {
+            SegmentedAddress at = StreamAddress(stream[i].address);
+            decoded[i] = SpecializedDecoders[stream[i].entry](Sim, at);
+        }
+        auto decodedAt = std::chrono::steady_clock::now();
+
+        listing.clear();
+        OpenCapture(*writer, &listing);
+        for (const Instruction &inst : decoded)
+        {
+            WriteInstruction(*writer, inst);
+        }
+        FlushOutput(*writer);
+        auto end = std::chrono::steady_clock::now();
+
+        checksum += listing.size();
+        lookupNs += std::chrono::duration<double, std::nano>(looked - begin).count();
+        decodeNs += std::chrono::duration<double, std::nano>(decodedAt - looked).count();
+        formatNs += std::chrono::duration<double, std::nano>(end - decodedAt).count();
+    }
+
+    double count = (double)stream.size() * STAGE_PASSES;
+    double totalNs = (lookupNs + decodeNs + formatNs) / count;
+    printf("%-10s %8zu %8.2f %8.2f %8.2f %8.2f %9.2f  (checksum %llu)\n", name, stream.size(), lookupNs / count,
+        decodeNs / count, formatNs / count, totalNs, 1000.0 / totalNs, (unsigned long long)checksum);
+}
+
+/**
+ * Guest loop for the interpreter: 65535 iterations of a 16 instruction body that mixes register, memory, stack and
+ * branch work from every family Execute supports.
+ */
+const uint8_t ExecutionKernel[] = {
+    0xB9, 0xFF, 0xFF,           // MOV CX, 0xFFFF
+    0xBE, 0x00, 0x02,           // MOV SI, 0x0200
+    0x8B, 0x04,                 // L1: MOV AX, [SI]
+    0x01, 0xC8,                 // ADD AX, CX
+    0x83, 0xD2, 0x00,           // ADC DX, 0
+    0x89, 0x44, 0x02,           // MOV [SI + 2], AX
+    0x93,                       // XCHG AX, BX
+    0x83, 0xEB, 0x03,           // SUB BX, 3
+    0x19, 0xDA,                 // SBB DX, BX
+    0x39, 0xD8,                 // CMP AX, BX
+    0x74, 0x01,                 // JZ L2
+    0x47,                       // INC DI
+    0x4D,                       // L2: DEC BP
+    0xF7, 0xD8,                 // NEG AX
+    0x50,                       // PUSH AX
+    0x5B,                       // POP BX
+    0xE3, 0x02,                 // JCXZ L3
+    0xE2, 0xE2                  // LOOP L1
+                                // L3:
+};
+
+/**
+ * Runs the kernel to completion EXECUTION_PASSES times with one dispatch strategy, decoding as it goes or running from
+ * the block cache, and reports guest MIPS.
+ */
+double TimeExecution(DispatchStrategy dispatch, bool cached)
+{
+    memset(Sim.memory, 0, MEMORY_SIZE);
+    memcpy(Sim.memory, ExecutionKernel, sizeof(ExecutionKernel));
+    Program program = {
+        .size = sizeof(ExecutionKernel),
+        .startAddr = 0,
+        .endAddr = sizeof(ExecutionKernel) - 1,
+        .loaded = true
+    };
+
+    uint64_t instructions = 0;
+    uint64_t checksum = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < EXECUTION_PASSES; pass++)
+    {
+        StartExecution(Sim, program);
+        ExecutionResult result = Run(Sim, program, EXECUTE_INSTRUCTION_LIMIT, dispatch, cached);
+        instructions += result.instructions;
+        checksum += Sim.cpu.registers[Register_a] + Sim.cpu.registers[Register_d] + Sim.cpu.registers[Register_bp];
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    double mips = instructions / seconds / 1e6;
+    printf("%-10s %-7s %12llu %10.3f %9.2f %8.2f  (checksum %llu)\n", DispatchNames[dispatch].data(),
+        cached ? "blocks" : "decode", (unsigned long long)instructions, seconds, mips, seconds * 1e9 / instructions, (unsigned long long)checksum);
+    return mips;
+}
+
+int main(int argc, char* argv[])
+{
+    const char *directory = (argc > 1) ? argv[1] : SIM_TESTS_DIR;
+    if (!InitMachine(Sim))
+    {
+        return 1;
+    }
+
+    uint32_t bytes = LoadCorpus(directory);
+
+    printf("Corpus: %u bytes, %zu instructions, %d passes\n\n", bytes, Corpus.size(), BENCH_PASSES);
+    if (Corpus.empty())
+    {
+        return 1;
+    }
+
+    double interpreted = TimeDecoder("interpreted", [](uint8_t entry, SegmentedAddress &at) {
+        return Decode(Sim, InstructionTable[entry], at);
+    });
+    double specialized = TimeDecoder("specialized", [](uint8_t entry, SegmentedAddress &at) {
+        return SpecializedDecoders[entry](Sim, at);
+    });
+
+    printf("\nSpecialized speedup: %.2fx\n", interpreted / specialized);
+
+    printf("\nBoundary scan\n\n");
+
+    double fullScan = TimeScan("full decode", bytes, [](SegmentedAddress at) -> uint8_t {
+        uint8_t entry = LookupEntry(Sim, at);
+        return (entry == NO_ENTRY) ? 0 : SpecializedDecoders[entry](Sim, at).size;
+    });
+    double lengthScan = TimeScan("length and op", bytes, [](SegmentedAddress at) -> uint8_t {
+        Operation op = None;
+        return DecodeInstructionLength(Sim, at, &op);
+    });
+    double tableScan = TimeScan("length table", bytes, [](SegmentedAddress at) -> uint8_t {
+        return InstructionLength(Sim.memory + ComputePhysicalAddress(at));
+    });
+    double batchedScan = TimeBatchedScan("batched", bytes);
+
+    printf("\nLength decoder speedup: %.2fx with the op, %.2fx table only, %.2fx batched\n", fullScan / lengthScan,
+        fullScan / tableScan, fullScan / batchedScan);
+
+    printf("\nDecoded listing of %zu instructions\n\n", Corpus.size() * LISTING_COPIES);
+
+    TimeListing<Instruction>("Instruction",
+        [](const Instruction &inst) { return inst; },
+        [](const Instruction &inst) { return inst; });
+    TimeListing<PackedInstruction>("packed",
+        [](const Instruction &inst) { return PackInstruction(inst); },
+        [](const PackedInstruction &packed) { return UnpackInstruction(packed); });
+
+    printf("\nInterpreter, %d runs of a %zu byte guest loop%s\n\n", EXECUTION_PASSES, sizeof(ExecutionKernel),
+        SIM_COMPUTED_GOTO ? "" : " (no computed goto, threaded falls back to the switch)");
+    printf("%-10s %-7s %12s %10s %9s %8s\n", "dispatch", "fetch", "insts", "seconds", "MIPS", "ns/inst");
+
+    double switchMips = TimeExecution(Dispatch_switch, false);
+    double threadedMips = TimeExecution(Dispatch_threaded, false);
+    double cachedSwitchMips = TimeExecution(Dispatch_switch, true);
+    double cachedThreadedMips = TimeExecution(Dispatch_threaded, true);
+
+    const BlockCacheStats &blocks = Sim.blocks.stats;
+    printf("\nThreaded speedup: %.2fx decoding, %.2fx from blocks\n", threadedMips / switchMips,
+        cachedThreadedMips / cachedSwitchMips);
+    printf("Block cache speedup: %.2fx switch, %.2fx threaded (last run: %llu hits, %llu misses, %llu evictions, "
+        "%llu chained)\n", cachedSwitchMips / switchMips, cachedThreadedMips / threadedMips,
+        (unsigned long long)blocks.hits, (unsigned long long)blocks.misses, (unsigned long long)blocks.evictions,
+        (unsigned long long)blocks.chained);
+
+    printf("\nStages in ns/inst, fixtures, the MOV perf test, then one generated %u KiB stream per mnemonic\n\n",
+        FAMILY_STREAM_SIZE / 1024);
+    printf("%-10s %8s %8s %8s %8s %8s %9s\n", "stream", "insts", "lookup", "decode", "format", "total", "Minst/s");
+
+    std::vector<GeneratedInstruction> fixtures;
+    for (const CorpusInstruction &inst : Corpus)
+    {
+        fixtures.push_back({ .address = inst.offset, .entry = inst.entry });
+    }
+    TimeStages("fixtures", fixtures);
+
+    // The MOV decoder perf test overwrites the corpus too
+    std::vector<GeneratedInstruction> movPerf = LoadImageStream(SIM_PERF_TEST);
+    if (movPerf.empty())
+    {
+        printf("%-10s could not read %s\n", "mov_perf", SIM_PERF_TEST);
+    }
+    else
+    {
+        TimeStages("mov_perf", movPerf);
+    }
+
+    // Generated streams fill the whole address space, so they come last
+    for (uint8_t op = None + 1; op < Op_count; op++)
+    {
+        uint32_t weights[Op_count] = {};
+        weights[op] = 1;
+
+        GeneratedStream stream = GenerateStream(Sim, FAMILY_STREAM_SIZE, weights, 0x8086 + op);
+        if (!stream.instructions.empty())
+        {
+            TimeStages(Mnemonics[op].data(), stream.instructions);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,198 @@
+// gen_main.cpp : Writes random but valid 8086 instruction streams along with their expected listings.
+
+#include "Sim8086.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#define SEED_FLAG "-s"
+#define SIZE_FLAG "-n"
+#define WEIGHTS_FLAG "-w"
+
+#define DEFAULT_STREAM_SIZE (64 * 1024)
+
+static OutputWriter Output = {};
+static Machine Sim = {};
+
+bool MnemonicMatches(std::string_view mnemonic, std::string_view text)
+{
+    return mnemonic.size() == text.size() && std::equal(mnemonic.begin(), mnemonic.end(), text.begin(),
+        [](char a, char b) { return a == std::toupper((unsigned char)b); });
+}
+
+/**
+ * Parses `MNEMONIC=weight` pairs separated by commas, e.g. `MOV=4,ADD=1,JNZ=1`. Mnemonics are case insensitive and
+ * every mnemonic not listed gets a weight of 0.
+ */
+bool ParseWeights(const char *text, uint32_t weights[Op_count])
+{
+    memset(weights, 0, sizeof(uint32_t) * Op_count);
+
+    std::string_view rest = text;
+    while (!rest.empty())
+    {
+        size_t comma = rest.find(',');
+        std::string_view pair = rest.substr(0, comma);
+        rest = (comma == std::string_view::npos) ? std::string_view() : rest.substr(comma + 1);
+
+        size_t equals = pair.find('=');
+        if (equals == std::string_view::npos)
+        {
+            return false;
+        }
+
+        std::string_view mnemonic = pair.substr(0, equals);
+        std::string_view weight = pair.substr(equals + 1);
+
+        int op = None + 1;
+        while (op < Op_count && !MnemonicMatches(Mnemonics[op], mnemonic))
+        {
+            op++;
+        }
+
+        uint32_t value = 0;
+        auto result = std::from_chars(weight.data(), weight.data() + weight.size(), value);
+        if (op == Op_count || result.ec != std::errc() || result.ptr != weight.data() + weight.size())
+        {
+            return false;
+        }
+
+        weights[op] = value;
+    }
+
+    return true;
+}
+
+/**
+ * Reports a flag given without the value it takes. The value has to come before the output base, which is always last.
+ */
+static int MissingValue(const char *flag)
+{
+    std::cerr << "ERROR: " << flag << " needs a value before the output base" << std::endl;
+    return 1;
+}
+
+/**
+ * Parses a whole decimal or 0x-prefixed hex number that fits in 32 bits.
+ */
+static bool ParseNumber(const char *text, uint32_t &value)
+{
+    char *end = nullptr;
+    unsigned long parsed = strtoul(text, &end, 0);
+    if (!isdigit((unsigned char)text[0]) || *end != '\0' || parsed > UINT32_MAX)
+    {
+        return false;
+    }
+
+    value = (uint32_t)parsed;
+    return true;
+}
+
+bool WriteImage(const std::string &path, const uint8_t *bytes, uint32_t size)
+{
+    int fd = OpenFdForWrite(path.c_str());
+    if (fd < 0)
+    {
+        std::cerr << "ERROR: Could not open output file " << path << std::endl;
+        return false;
+    }
+
+    OpenOutput(Output, fd);
+    WriteThrough(Output, (const char *)bytes, size);
+    CloseFd(fd);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: sim_gen [-s seed] [-n bytes] [-w MNEMONIC=weight,...] <output base>" << std::endl;
+        return 1;
+    }
+
+    uint32_t seed = 0x8086;
+    uint32_t size = DEFAULT_STREAM_SIZE;
+    uint32_t weights[Op_count] = {};
+    for (int op = None + 1; op < Op_count; op++)
+    {
+        weights[op] = 1;
+    }
+
+    for (int i = 1; i < argc - 1; i++)
+    {
+        if (strcmp(argv[i], SEED_FLAG) == 0)
+        {
+            if (i + 1 >= argc - 1)
+            {
+                return MissingValue(SEED_FLAG);
+            }
+            if (!ParseNumber(argv[++i], seed))
+            {
+                std::cerr << "ERROR: Seed must be a decimal or 0x hex number, e.g. -s 0x8086" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], SIZE_FLAG) == 0)
+        {
+            if (i + 1 >= argc - 1)
+            {
+                return MissingValue(SIZE_FLAG);
+            }
+            if (!ParseNumber(argv[++i], size) || size < MAX_INSTRUCTION_LENGTH)
+            {
+                std::cerr << "ERROR: Size must be a number of bytes, at least " << MAX_INSTRUCTION_LENGTH
+                    << ", e.g. -n 65536" << std::endl;
+                return 1;
+            }
+            size = std::min<uint32_t>(size, MEMORY_SIZE);
+        }
+        else if (strcmp(argv[i], WEIGHTS_FLAG) == 0)
+        {
+            if (i + 1 >= argc - 1)
+            {
+                return MissingValue(WEIGHTS_FLAG);
+            }
+            if (!ParseWeights(argv[++i], weights))
+            {
+                std::cerr << "ERROR: Weights must be MNEMONIC=weight pairs separated by commas, e.g. MOV=4,ADD=1" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    if (!InitMachine(Sim))
+    {
+        std::cerr << "ERROR: Could not allocate simulator memory" << std::endl;
+        return 1;
+    }
+
+    GeneratedStream stream = GenerateStream(Sim, size, weights, seed);
+    if (stream.instructions.empty())
+    {
+        std::cerr << "ERROR: The weights select no instructions" << std::endl;
+        return 1;
+    }
+
+    std::string base = argv[argc - 1];
+    if (!WriteImage(base + ".bin", Sim.memory, stream.size) || !OpenAsmFile(Output, base + ".asm"))
+    {
+        return 1;
+    }
+
+    // The expected listing comes from the fields the generator picked rather than from the decoder under test
+    for (const GeneratedInstruction &generated : stream.instructions)
+    {
+        WriteInstruction(Output, generated.instruction);
+    }
+    CloseAsmFile(Output);
+
+    std::cout << "Generated " << stream.instructions.size() << " instructions, " << stream.size << " bytes" << std::endl;
+
+    ReleaseMachine(Sim);
+    return 0;
+}
@@ -53,23 +53,23 @@ INST_ALT(OUT, { B(Op, 1110111), ImpD(0b0), W, ImpReg(0b000), ImpMod(0b11), ImpRm
 
 INST(ADD, {B(Op, 000000), D, W, Mod, Reg, Rm})
 INST_ALT(ADD, { B(Op, 100000), S, ImpD(0b0), W, Mod, OpExtension(000), Rm, Imm })
-INST_ALT(ADD, { B(Op, 0001010), ImpD(0b0), W, ImpReg(0b000), Imm })
+INST_ALT(ADD, { B(Op, 0000010), ImpD(0b1), W, ImpReg(0b000), Imm })
 
 INST(ADC, {B(Op, 000100), D, W, Mod, Reg, Rm})
 INST_ALT(ADC, { B(Op, 100000), S, ImpD(0b0), W, Mod, OpExtension(010), Rm, Imm })
-INST_ALT(ADC, { B(Op, 0001010), ImpD(0b0), W, ImpReg(0b000), Imm })
+INST_ALT(ADC, { B(Op, 0001010), ImpD(0b1), W, ImpReg(0b000), Imm })
 
 INST(SUB, {B(Op, 001010), D, W, Mod, Reg, Rm})
 INST_ALT(SUB, { B(Op, 100000), S, ImpD(0b0), W, Mod, OpExtension(101), Rm, Imm })
-INST_ALT(SUB, { B(Op, 0010110), ImpD(0b0), W, ImpReg(0b000), Imm })
+INST_ALT(SUB, { B(Op, 0010110), ImpD(0b1), W, ImpReg(0b000), Imm })
 
 INST(SBB, {B(Op, 000110), D, W, Mod, Reg, Rm})
 INST_ALT(SBB, { B(Op, 100000), S, ImpD(0b0), W, Mod, OpExtension(011), Rm, Imm })
-INST_ALT(SBB, { B(Op, 0001110), ImpD(0b0), W, ImpReg(0b000), Imm })
+INST_ALT(SBB, { B(Op, 0001110), ImpD(0b1), W, ImpReg(0b000), Imm })
 
 INST(CMP, {B(Op, 001110), D, W, Mod, Reg, Rm})
 INST_ALT(CMP, { B(Op, 100000), S, ImpD(0b0), W, Mod, OpExtension(111), Rm, Imm })
-INST_ALT(CMP, { B(Op, 0011110), ImpD(0b0), W, ImpReg(0b000), Imm })
+INST_ALT(CMP, { B(Op, 0011110), ImpD(0b1), W, ImpReg(0b000), Imm })
 
 INST(DEC, {B(Op, 1111111), ImpD(0b0), { W_bit, NONE, 0b1, 0, 1}, Mod, OpExtension(001), Rm})
 INST_ALT(DEC, { B(Op, 01001), ImpD(0b1), ImpW(0b1), {Reg_bit, NONE, 0b111, 0, 3} })
@@ -89,7 +89,7 @@ INST(JMP, {B(Op, 11101001), ImpW(1), Displacement})
 INST_ALT(JMP, { B(Op, 11101011), ImpW(0), Displacement})
 INST_ALT(JMP, { B(Op, 11111111), ImpW(1), Mod, OpExtension(100), Rm })
 // INST_ALT(JMP, { B(Op, 11101011), ImpW(0), Inc(IPInc_bit), Inc(CS_bit) })
-INST_ALT(JMP, { B(Op, 11111111), ImpW(1), Mod, OpExtension(101), Rm })
+INST_ALT(JMP, { B(Op, 11111111), ImpW(1), Mod, OpExtension(101), Rm }, SetFlags(CSInc))
 
 INST(JZ, { B(Op, 01110100), ImpW(0), Displacement})
 
@@ -132,7 +132,7 @@ INST(LOOPNZ, { B(Op, 11100000), ImpW(0), Displacement})
 INST(JCXZ, { B(Op, 11100011), ImpW(0), Displacement})
 
 INST(RET, { B(Op, 11000011), ImpW(0) })
-INST_ALT(RET, { B(Op, 11000011), ImpW(1), Imm })
+INST_ALT(RET, { B(Op, 11000010), ImpW(1), Imm })
 
 #undef INST
 #undef INST_ALT
@@ -1,11 +1,35 @@
 // sim8086.cpp : Defines the entry point for the application.
 
-#include "Sim8086.cpp"
+#include "Sim8086.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <thread>
 
 #define EXECUTE_MODE "-e"
+#define STATS_FLAG "-s"
+#define OUTPUT_FLAG "-o"
+#define LOAD_FLAG "-l"
+#define RECURSIVE_FLAG "-r"
+#define THREADS_FLAG "-j"
+#define BATCH_FLAG "-b"
+#define EXPORT_FLAG "-x"
+#define VERIFY_FLAG "-v"
+
+static OutputWriter Output = {};
+static Machine Sim = {};
+
+/**
+ * Reports a flag given without the value it takes. The value has to come before the input file, which is always last.
+ */
+static int MissingValue(const char *flag)
+{
+    std::cerr << "ERROR: " << flag << " needs a value before the input file" << std::endl;
+    return 1;
+}
 
 int main(int argc, char* argv[])
 {
@@ -15,17 +39,213 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    char* mode = argv[1];
+    bool execute = false;
+    bool printStats = false;
+    bool recursive = false;
+    bool batch = false;
+    bool verify = false;
+    uint32_t threadCount = 0;
+    const char* outputFile = nullptr;
+    const char* exportFile = nullptr;
+    SegmentedAddress loadAddress = {};
+    for (int i = 1; i < argc - 1; i++)
+    {
+        if (strcmp(argv[i], EXECUTE_MODE) == 0)
+        {
+            execute = true;
+        }
+        else if (strcmp(argv[i], BATCH_FLAG) == 0)
+        {
+            batch = true;
+        }
+        else if (strcmp(argv[i], VERIFY_FLAG) == 0)
+        {
+            verify = true;
+        }
+        else if (strcmp(argv[i], RECURSIVE_FLAG) == 0)
+        {
+            recursive = true;
+        }
+        else if (strcmp(argv[i], STATS_FLAG) == 0)
+        {
+            printStats = true;
+        }
+        else if (strcmp(argv[i], OUTPUT_FLAG) == 0)
+        {
+            if (i + 1 >= argc - 1)
+            {
+                return MissingValue(OUTPUT_FLAG);
+            }
+            outputFile = argv[++i];
+        }
+        else if (strcmp(argv[i], EXPORT_FLAG) == 0)
+        {
+            if (i + 1 >= argc - 1)
+            {
+                return MissingValue(EXPORT_FLAG);
+            }
+            exportFile = argv[++i];
+        }
+        else if (strcmp(argv[i], THREADS_FLAG) == 0)
+        {
+            if (i + 1 >= argc - 1)
+            {
+                return MissingValue(THREADS_FLAG);
+            }
+            char *end = nullptr;
+            const char *value = argv[++i];
+            unsigned long count = strtoul(value, &end, 10);
+            if (!isdigit((unsigned char)value[0]) || *end != '\0' || count == 0 || count > UINT32_MAX)
+            {
+                std::cerr << "ERROR: Thread count must be a positive number, e.g. -j 4" << std::endl;
+                return 1;
+            }
+            threadCount = (uint32_t)count;
+        }
+        else if (strcmp(argv[i], LOAD_FLAG) == 0)
+        {
+            if (i + 1 >= argc - 1)
+            {
+                return MissingValue(LOAD_FLAG);
+            }
+            if (!ParseSegmentedAddress(argv[++i], loadAddress))
+            {
+                std::cerr << "ERROR: Load address must be hex segment:offset, e.g. 1000:0100" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    // Each mode writes something different, so a second mode flag would otherwise be dropped without a word
+    if (execute + verify + (exportFile != nullptr) > 1)
+    {
+        std::cerr << "ERROR: " << EXECUTE_MODE << ", " << VERIFY_FLAG << " and " << EXPORT_FLAG
+            << " select different modes and can't be combined" << std::endl;
+        return 1;
+    }
+    if (batch && (verify || exportFile))
+    {
+        std::cerr << "ERROR: " << BATCH_FLAG << " only lists or runs images, so it can't be combined with "
+            << (verify ? VERIFY_FLAG : EXPORT_FLAG) << std::endl;
+        return 1;
+    }
+    if (outputFile && (verify || exportFile || (execute && !batch)))
+    {
+        std::cerr << "ERROR: " << OUTPUT_FLAG << " writes a listing, so it can't be combined with "
+            << (verify ? VERIFY_FLAG : exportFile ? EXPORT_FLAG : EXECUTE_MODE) << std::endl;
+        return 1;
+    }
+    if (recursive && (execute || verify || exportFile))
+    {
+        std::cerr << "ERROR: " << RECURSIVE_FLAG << " only changes how a listing is decoded, so it can't be combined with "
+            << (execute ? EXECUTE_MODE : verify ? VERIFY_FLAG : EXPORT_FLAG) << std::endl;
+        return 1;
+    }
+
+    if (batch)
+    {
+        std::vector<std::string> paths;
+        if (!CollectBatchPaths(argv[argc - 1], paths))
+        {
+            std::cerr << "ERROR: Could not read batch " << argv[argc - 1] << std::endl;
+            return 1;
+        }
+
+        if (!outputFile)
+        {
+            OpenOutput(Output, STDOUT_FD);
+        }
+        else if (!OpenAsmFile(Output, outputFile))
+        {
+            return 1;
+        }
+
+        uint32_t workers = threadCount ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+        DecodeStats stats = {};
+        uint32_t failures = RunBatch(paths, Output, stats, workers, execute, recursive, loadAddress);
+        if (outputFile)
+        {
+            CloseAsmFile(Output);
+        }
+
+        if (printStats)
+        {
+            PrintDecodeStats(stats);
+        }
+
+        return failures == 0 ? 0 : 1;
+    }
+
+    if (!InitMachine(Sim))
+    {
+        std::cerr << "ERROR: Could not allocate simulator memory" << std::endl;
+        return 1;
+    }
+
     std::string asmFile = argv[argc - 1];
-    struct Program program = LoadProgramIntoMemory(asmFile);
+    struct Program program = LoadProgramIntoMemory(Sim, asmFile, loadAddress);
+    if (!program.loaded)
+    {
+        return 1;
+    }
+
+    auto disassemble = [&](Program &program, OutputWriter &output) {
+        if (recursive)
+        {
+            DisassembleRecursive(Sim, program, output);
+        }
+        else
+        {
+            DisassembleParallel(Sim, program, output, std::max(1u, threadCount));
+        }
+    };
 
-    if (strcmp(mode, EXECUTE_MODE) == 0)
+    int exitCode = 0;
+    if (execute)
     {
-        Execute(program);
+        Execute(Sim, program);
+    }
+    else if (verify)
+    {
+        OpenOutput(Output, STDOUT_FD);
+        VerifyResult result = VerifyImage(Sim, program, Output);
+        std::cout << "Verified " << result.instructions << " instructions: " << result.mismatches << " mismatched, "
+            << result.undecodedBytes << " undecodable bytes" << std::endl;
+        exitCode = (result.mismatches == 0 && result.undecodedBytes == 0) ? 0 : 1;
+    }
+    else if (exportFile)
+    {
+        int fd = OpenFdForWrite(exportFile);
+        if (fd < 0)
+        {
+            std::cerr << "ERROR: Could not open export file " << exportFile << std::endl;
+            return 1;
+        }
+
+        OpenOutput(Output, fd);
+        ExportColumns(Sim, program, Output);
+        CloseFd(fd);
+    }
+    else if (outputFile)
+    {
+        if (!OpenAsmFile(Output, outputFile))
+        {
+            return 1;
+        }
+
+        disassemble(program, Output);
+        CloseAsmFile(Output);
     }
     else {
-        Disassemble(program);
+        OpenOutput(Output, STDOUT_FD);
+        disassemble(program, Output);
     }
-    
-    return 0;
+
+    if (printStats)
+    {
+        PrintDecodeStats(Sim.stats);
+    }
+
+    ReleaseMachine(Sim);
+    return exitCode;
 }
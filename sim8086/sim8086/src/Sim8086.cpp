@@ -1,620 +1,399 @@
-
-#include <cstdint>
+#include "Sim8086.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <cstdio>
-
-
-/**
- * NOTE
- *  - Pay attention to JMP instructions when we get to execution stage. There are intersegment and within segment jumps. These 
- *      could get interesting since the instruction format is identical only different OpExtension bits. 
- */
-#define ArrayCount(array) sizeof(array)/sizeof(array[0])
-
-#define LO_BITS 0
-#define HI_BITS 1
-#define FULL_BITS 2
-
-#define TRUE 1
-#define FALSE 0
-
-#define SRC 0
-#define DEST 1
-
-#define MEMORY_SIZE 1024 * 1024
-#define BUFFER_SIZE 1000
-#define INST_LENGTH 30
-
-#define HasField(mask, field) (mask & (1 << field))
-#define ComputePhysicalAddress(at) ((at.segment * 16) + at.offset)
-#define IncrementAddress(at) at.offset++
-
-static uint8_t Memory[MEMORY_SIZE];
-
-struct SegmentedAddress {
-    uint16_t segment;
-    uint16_t offset;
-};
-
-SegmentedAddress Create(uint16_t segment, uint16_t offset) {
-    return { 
-        .segment=segment, 
-        .offset=(uint16_t)offset 
-    };
-}
-
-enum RegisterIndex {
-    
-    Register_a,
-    Register_b,
-    Register_c,
-    Register_d,
-    Register_sp,
-    Register_bp,
-    Register_si,
-    Register_di,
-
-    Register_count
-};
-
-enum SegmentRegisters {
-    CS,
-    SS,
-    DS,
-    ES,
-
-    Segment_count
-};
-
-struct CPU {
-    uint16_t IP;
-    uint16_t registers[Register_count];
-    uint16_t segmentRegisters[Segment_count];
-};
-
-struct Program {
-    uint32_t size;
-    uint32_t startAddr;
-    uint32_t endAddr;
-};
-
-uint8_t ReadByteFromMemory(SegmentedAddress at) {
-    uint32_t address = ComputePhysicalAddress(at);
-    return Memory[address];
-}
-
-uint16_t ReadWordFromMemory(SegmentedAddress at) {
-    uint32_t address = ComputePhysicalAddress(at);
-    uint8_t lo = Memory[address];
-    uint16_t hi = Memory[address+1];
-    return ((hi << 8) | lo);
-}
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
 
-uint8_t FetchNextInstructionByte(CPU &cpu) {
-    SegmentedAddress at = { .segment=cpu.segmentRegisters[CS], .offset=cpu.IP};
-    uint32_t address = ComputePhysicalAddress(at);
-    cpu.IP++;
-    return Memory[address];
-}
-
-
-enum Field : uint8_t
-{
-    Op,
-    OpExtension,
-    W_bit,
-    D_bit,
-    Reg_bit,
-    Rm_bit,
-    Mod_bit,
-    Imm_bit,
-    Addr_bit,
-    S_bit,
-    Data_bit,
-    Displacement_bit,
-
-    Field_count
-};
-
-struct RegisterAccess {
-    uint8_t index;      // index of the register in the 8086 manual. For example, register AX/AL is 000 while register CX/CL is 001
-    uint8_t offset;     // offset in the register, 0 - low bits, 1 - high bits, 2 - full 16 bits (no offset)
-};
+/* Opcode Dispatch */
 
-enum ModCategory: uint8_t 
+void AccumulateStats(DecodeStats &into, const DecodeStats &stats)
 {
-    Memory_mode_no_disp,
-    Memory_mode_8_bit_disp,
-    Memory_mode_16_bit_disp,
-    Register_mode,
-
-    Mod_category_count
-};
+    into.instructions += stats.instructions;
+    into.decodeAttempts += stats.decodeAttempts;
+    into.rejectedDecodes += stats.rejectedDecodes;
+    into.speculativeDecodesAvoided += stats.speculativeDecodesAvoided;
+}
 
-enum EffectiveAddressCalculation: uint8_t 
+void PrintDecodeStats(const DecodeStats &stats)
 {
-    Effective_addr_direct_address,
-
-    Effective_addr_bx_si,
-    Effective_addr_bx_di,
-    Effective_addr_bp_si,
-    Effective_addr_bp_di,
-    Effective_addr_si,
-    Effective_addr_di,
-    Effective_addr_bx,
-    Effective_addr_bp,
-
-    Effective_addr_count
-};
+    fprintf(stderr, "Decoded instructions:        %llu\n", (unsigned long long)stats.instructions);
+    fprintf(stderr, "Decode attempts:             %llu\n", (unsigned long long)stats.decodeAttempts);
+    fprintf(stderr, "Rejected decodes:            %llu\n", (unsigned long long)stats.rejectedDecodes);
+    fprintf(stderr, "Speculative decodes avoided: %llu\n", (unsigned long long)stats.speculativeDecodesAvoided);
+}
 
-struct EffectiveAddrExpression
-{
-    EffectiveAddressCalculation calculationType;
-    RegisterAccess base;
-    RegisterAccess index;
-    uint8_t hasDisplacement;
-    int16_t displacement;
-};
+/* ModRM Decoding */
 
-void DecodeEffectiveAddrExpression(uint8_t mod, uint8_t rm, EffectiveAddrExpression &expression, SegmentedAddress &at) 
+bool OperandsEqual(const Operand &a, const Operand &b)
 {
-    switch(rm)
+    if (a.type != b.type)
     {
-        case 0b000:
-            {
-                expression.calculationType = Effective_addr_bx_si;
-                expression.base.index = Register_b;
-                expression.base.offset = FULL_BITS ;
-
-                expression.index.index = Register_si;
-                expression.index.offset = FULL_BITS;
-            } break;
-        case 0b001:
-            {
-                expression.calculationType = Effective_addr_bx_di;
-                expression.base.index = Register_b;
-                expression.base.offset = FULL_BITS;
+        return false;
+    }
 
-                expression.index.index = Register_di;
-                expression.index.offset = FULL_BITS;
-            } break;
-        case 0b010:
+    switch(a.type)
+    {
+        case OpType_register:
             {
-                expression.calculationType = Effective_addr_bp_si;
-                expression.base.index = Register_bp;
-                expression.base.offset = FULL_BITS;
-
-                expression.index.index = Register_si;
-                expression.index.offset = FULL_BITS;
+                return a.reg.index == b.reg.index && a.reg.offset == b.reg.offset;
             } break;
-        case 0b011:
+        case OpType_effectiveAddrCalc:
             {
-                expression.calculationType = Effective_addr_bp_di;
-                expression.base.index = Register_bp;
-                expression.base.offset = FULL_BITS;
-
-                expression.index.index = Register_di;
-                expression.index.offset = FULL_BITS;
+                return a.expression.calculationType == b.expression.calculationType &&
+                    a.expression.base.index == b.expression.base.index &&
+                    a.expression.base.offset == b.expression.base.offset &&
+                    a.expression.index.index == b.expression.index.index &&
+                    a.expression.index.offset == b.expression.index.offset &&
+                    a.expression.hasDisplacement == b.expression.hasDisplacement &&
+                    a.expression.displacement == b.expression.displacement;
             } break;
-        case 0b100:
+        case OpType_immediate:
             {
-                expression.calculationType = Effective_addr_si;
-                expression.base.index = Register_si;
-                expression.base.offset = FULL_BITS;
+                return a.immediate == b.immediate;
             } break;
-        case 0b101:
+        case OpType_jmp:
             {
-                expression.calculationType = Effective_addr_di;
-                expression.base.index = Register_di;
-                expression.base.offset = FULL_BITS;
+                return a.address == b.address;
             } break;
-        case 0b110:
-            {
-                if (mod == Memory_mode_no_disp)
-                {
-                    expression.calculationType = Effective_addr_direct_address; 
-                    expression.displacement = (int16_t)ReadWordFromMemory(at);
-                    IncrementAddress(at);
-                    IncrementAddress(at);
-                }
-                else
-                {
-                    expression.calculationType = Effective_addr_bp;
-                    expression.base.index = Register_bp;
-                    expression.base.offset = FULL_BITS;
-                }
-            }break;
-        case 0b111:
+        default:
             {
-                expression.calculationType = Effective_addr_bx;
-                expression.base.index = Register_b;
-                expression.base.offset = FULL_BITS;
-            } break; 
+                return true;
+            }
     }
 }
 
-/* Operation Definitions */
+bool InstructionsEqual(const Instruction &a, const Instruction &b)
+{
+    return a.op == b.op && a.address == b.address && a.size == b.size && a.flags == b.flags &&
+        OperandsEqual(a.operands[SRC], b.operands[SRC]) && OperandsEqual(a.operands[DEST], b.operands[DEST]);
+}
 
-enum Operation: uint8_t {
-    None,
-#define INST(mnemonic, ...) Op_##mnemonic,
-#define INST_ALT(...)
-#include "InstructionTable.inl"
-#undef INST
-#undef INST_ALT
-    Op_count
-};
+/* Block Cache */
 
-const char* Mnemonics[] = {
-    "none",
-#define INST(mnemonic, ...) #mnemonic,
-#define INST_ALT(...)
-#include "InstructionTable.inl"
-#undef INST
-#undef INST_ALT
-};
+void InitBlockCache(BlockCache &cache, size_t budget)
+{
+    size_t tableBytes = BLOCK_CACHE_SLOTS * sizeof(CachedBlock);
+    size_t poolBytes = (budget > tableBytes) ? budget - tableBytes : 0;
+
+    cache.slots.assign(BLOCK_CACHE_SLOTS, {});
+    cache.instructions.assign(std::max<size_t>(poolBytes / sizeof(Instruction), BLOCK_MAX_INSTRUCTIONS), {});
+    cache.stats = {};
+    FlushBlockCache(cache);
+}
+
+void FlushBlockCache(BlockCache &cache)
+{
+    for (CachedBlock &block : cache.slots)
+    {
+        block.address = NO_BLOCK;
+    }
+
+    cache.used = 0;
+    cache.live = 0;
+    cache.current = {};
+    cache.previous = NO_BLOCK;
+    cache.predicted = NO_BLOCK;
+    memset(cache.codePages, 0, sizeof(cache.codePages));
+    memset(cache.pageBlocks, 0, sizeof(cache.pageBlocks));
+}
 
 /**
- * Represents the bit patterns/fields in an Intel 8086 instruction
+ * Counts `block` in, or out of, every code page its bytes overlap, keeping the page bits in step with the counts.
  */
-struct Bits 
+static void TrackCodePages(BlockCache &cache, const CachedBlock &block, bool live)
 {
-    Field field;
-    uint8_t value;
-    uint8_t mask;
-    uint8_t shift;
-    uint8_t count;
-};
+    uint32_t last = (block.address + block.size - 1) >> CODE_PAGE_SHIFT;
+    for (uint32_t page = block.address >> CODE_PAGE_SHIFT; page <= last && page < CODE_PAGE_COUNT; page++)
+    {
+        uint16_t count = live ? ++cache.pageBlocks[page] : --cache.pageBlocks[page];
+        uint64_t bit = 1ull << (page & 63);
+        if (count)
+        {
+            cache.codePages[page >> 6] |= bit;
+        }
+        else
+        {
+            cache.codePages[page >> 6] &= ~bit;
+        }
+    }
+}
 
-enum Flags {
-    Wide = (1 << 0),
-    IPInc = (1 << 1),
-    CSInc = (1 << 2),
-    RmIsWide = (1 << 3)
-};
+void InvalidateCode(BlockCache &cache, uint32_t address)
+{
+    // A block is at most BLOCK_MAX_BYTES long, so only blocks starting that close below `address` can cover it
+    uint32_t lowest = (address >= BLOCK_MAX_BYTES) ? address - BLOCK_MAX_BYTES + 1 : 0;
+    for (uint32_t start = lowest; start <= address; start++)
+    {
+        CachedBlock &block = cache.slots[BlockSlot(start)];
+        if (block.address != start || start + block.size <= address)
+        {
+            continue;
+        }
 
-struct Entry {
-    Operation mnemonic;
-    Bits bits[Field::Field_count];
-    uint16_t flags;
-};
+        TrackCodePages(cache, block, false);
+        block.address = NO_BLOCK;
+        cache.live--;
+        cache.stats.invalidations++;
 
-Entry InstructionTable[] = {
-#include "InstructionTable.inl"
-};
+        // The running block may be the one that was just patched, so fetch the next instruction afresh
+        cache.current.end = cache.current.next;
+    }
+}
 
-const char* RegisterNames[Register_count][3] = {
-    {"AL", "AH", "AX"},
-    {"BL", "BH", "BX"},
-    {"CL", "CH", "CX"},
-    {"DL", "DH", "DX"},
-    {"", "", "SP"},
-    {"", "", "BP"},
-    {"", "", "SI"},
-    {"", "", "DI"}
-};
+/* Machine */
 
-void DecodeRegister(uint8_t reg, uint8_t w, RegisterAccess &regAccess)
+bool InitMachine(Machine &machine)
 {
-    switch(reg)
-    {
-        case 0b000:
-            {
-                regAccess.index = Register_a;
-                regAccess.offset = (w == 0) ? LO_BITS : FULL_BITS;
-            } break; 
-        case 0b001:
-            {
-                regAccess.index = Register_c;
-                regAccess.offset = (w == 0) ? LO_BITS : FULL_BITS;	
-            } break;
-        case 0b010:
-            {
-                regAccess.index = Register_d;
-                regAccess.offset = (w == 0) ? LO_BITS : FULL_BITS;	
-            } break;  
-        case 0b011:
-            {
-                regAccess.index = Register_b;
-                regAccess.offset = (w == 0) ? LO_BITS : FULL_BITS;	
-            } break;  
-        case 0b100:
-            {
-                if (w == 0)
-                {
-                    regAccess.index = Register_a;
-                    regAccess.offset = HI_BITS;
-                }
-                else
-                {
-                    regAccess.index = Register_sp;
-                    regAccess.offset = FULL_BITS;
-                }
-            } break;
-        case 0b101:
-            {
-                if (w == 0)
-                {
-                    regAccess.index = Register_c;
-                    regAccess.offset = HI_BITS;
-                }
-                else
-                {
-                    regAccess.index = Register_bp;
-                    regAccess.offset = FULL_BITS;
-                }
-            } break;
-        case 0b110:
-            {
-                if (w == 0)
-                {
-                    regAccess.index = Register_d;
-                    regAccess.offset = HI_BITS;
-                }
-                else
-                {
-                    regAccess.index = Register_si;
-                    regAccess.offset = FULL_BITS;
-                }
-            } break;
-        case 0b111:
-            {
-                if (w == 0)
-                {
-                    regAccess.index = Register_b;
-                    regAccess.offset = HI_BITS;
-                }
-                else
-                {
-                    regAccess.index = Register_di;
-                    regAccess.offset = FULL_BITS;
-                }
-            } break;
-    }
+    machine.cpu = {};
+    machine.decoded = {};
+    machine.stats = {};
+
+#ifdef _WIN32
+    machine.memory = new (std::nothrow) uint8_t[MEMORY_MAPPING_SIZE]();
+#else
+    void *space = mmap(nullptr, MEMORY_MAPPING_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    machine.memory = (space == MAP_FAILED) ? nullptr : static_cast<uint8_t*>(space);
+#endif
+
+    return machine.memory != nullptr;
 }
 
+void ReleaseMachine(Machine &machine)
+{
+    if (!machine.memory)
+    {
+        return;
+    }
 
-enum OperandType {
-    OpType_none, 
+#ifdef _WIN32
+    delete[] machine.memory;
+#else
+    munmap(machine.memory, MEMORY_MAPPING_SIZE);
+#endif
 
-    OpType_register,
-    OpType_effectiveAddrCalc,
-    OpType_immediate,
-    OpType_jmp,
+    machine.memory = nullptr;
+}
 
-    OpType_count
-};
+/* Output */
 
-struct Jump {
-    uint16_t ipAddress;
-    uint16_t csAddress;
-};
+void OpenOutput(OutputWriter &writer, int fd)
+{
+    writer.used = 0;
+    writer.fd = fd;
+    writer.capture = nullptr;
+}
 
-struct Operand {
-    OperandType type;
-    union {
-        RegisterAccess reg;
-        EffectiveAddrExpression expression;
-        int16_t immediate;
-        uint32_t address;
-        Jump jmp;
-    };
-};
+void OpenCapture(OutputWriter &writer, std::string *capture)
+{
+    writer.used = 0;
+    writer.fd = -1;
+    writer.capture = capture;
+}
 
-struct Instruction {
-    Operation op;
-    uint32_t address;
-    uint16_t size;
-    uint16_t flags;
-    Operand operands[2];
-};
+void WriteThrough(OutputWriter &writer, const char *data, size_t size)
+{
+    if (writer.capture)
+    {
+        writer.capture->append(data, size);
+        return;
+    }
 
-Instruction DecodedInstructions[BUFFER_SIZE];     // String instruction buffer. Holds all ASM instructions to be printed 
-static uint16_t DecodedInstIndex = 0;
+    size_t written = 0;
+    while (written < size)
+    {
+        auto result = WriteFd(writer.fd, data + written, (unsigned)(size - written));
+        if (result <= 0)
+        {
+            break;
+        }
+        written += (size_t)result;
+    }
+}
 
-std::ofstream OpenAsmFile(std::string name)
+void FlushOutput(OutputWriter &writer)
 {
-    std::ofstream asmFile;
-    asmFile.open(name);
+    WriteThrough(writer, writer.buffer, writer.used);
+    writer.used = 0;
+}
 
-    // TODO: Check if file failed to open.
-    if (!asmFile.is_open())
+bool OpenAsmFile(OutputWriter &writer, const std::string &name)
+{
+    int fd = OpenFdForWrite(name.c_str());
+    if (fd < 0)
     {
-        std::cerr << "Could not open file" << std::endl;
-        return asmFile;
+        std::cerr << "ERROR: Could not open output file " << name << "\n";
+        return false;
     }
 
-    // Write header of asm file 
-    asmFile << "bits 16\n\n";
-    return asmFile;
+    OpenOutput(writer, fd);
+    WriteText(writer, "bits 16\n\n");
+    return true;
 }
 
-void CloseAsmFile(std::ofstream &file)
+void CloseAsmFile(OutputWriter &writer)
 {
-    file.close();
+    FlushOutput(writer);
+    CloseFd(writer.fd);
+    writer.fd = -1;
 }
 
-void PrintEffectiveAddressExpression(Operand op)
+void WriteEffectiveAddressExpression(OutputWriter &writer, const EffectiveAddrExpression &expression)
 {
-    switch(op.expression.calculationType)
+    switch(expression.calculationType)
     {
         case Effective_addr_direct_address:
             {
-                printf("[%d]", op.expression.displacement); 
+                WriteText(writer, "[");
+                WriteNumber(writer, expression.displacement);
+                WriteText(writer, "]");
             } break;
         case Effective_addr_bx_si:
         case Effective_addr_bx_di:
         case Effective_addr_bp_si:
         case Effective_addr_bp_di:
             {
-                const char* base = RegisterNames[op.expression.base.index][op.expression.base.offset];
-                const char* index = RegisterNames[op.expression.index.index][op.expression.index.offset];
-                if (op.expression.hasDisplacement == FALSE)
+                WriteText(writer, "[");
+                WriteText(writer, RegisterNames[expression.base.index][expression.base.offset]);
+                WriteText(writer, " + ");
+                WriteText(writer, RegisterNames[expression.index.index][expression.index.offset]);
+                if (expression.hasDisplacement)
                 {
-                    printf("[%s + %s]", base, index);
-                }
-                else
-                {   
-                    if (op.expression.displacement < 0)
-                    {
-                        printf("[%s + %s - %d]", base, index, -op.expression.displacement);
-                    }
-                    else
-                    {
-                        printf("[%s + %s + %d]", base, index, op.expression.displacement);
-                    }
+                    WriteText(writer, (expression.displacement < 0) ? " - " : " + ");
+                    WriteNumber(writer, (expression.displacement < 0) ? -expression.displacement : expression.displacement);
                 }
+                WriteText(writer, "]");
             } break;
         case Effective_addr_si:
         case Effective_addr_di:
         case Effective_addr_bx:
         case Effective_addr_bp:
             {
-                const char* base = RegisterNames[op.expression.base.index][op.expression.base.offset];
-                if (op.expression.displacement == 0)
-                {
-                    printf("[%s]", base);
-                }
-                else
+                WriteText(writer, "[");
+                WriteText(writer, RegisterNames[expression.base.index][expression.base.offset]);
+                if (expression.displacement != 0)
                 {
-                    if (op.expression.displacement < 0)
-                    {
-                        printf("[%s - %d]", base, -op.expression.displacement);
-                    }
-                    else 
-                    {
-                        printf("[%s + %d]", base, op.expression.displacement);
-                    }
+                    WriteText(writer, (expression.displacement < 0) ? " - " : " + ");
+                    WriteNumber(writer, (expression.displacement < 0) ? -expression.displacement : expression.displacement);
                 }
+                WriteText(writer, "]");
             } break;
-            case Effective_addr_count:
-            { 
+        case Effective_addr_count:
+            {
             } break;
     }
 }
 
-void PrintOperand(Operand op)
+void WriteOperand(OutputWriter &writer, const Operand &op)
 {
     switch(op.type)
     {
-        case OpType_none:
-        {
-            return;
-        } break;
         case OpType_register:
             {
-                const char* name = RegisterNames[op.reg.index][op.reg.offset];
-                printf("%s", name);		
+                WriteText(writer, RegisterNames[op.reg.index][op.reg.offset]);
             } break;
         case OpType_effectiveAddrCalc:
             {
-                PrintEffectiveAddressExpression(op);
+                WriteEffectiveAddressExpression(writer, op.expression);
             } break;
         case OpType_immediate:
-        {
-            printf("%d", op.immediate);
-        } break;
+            {
+                WriteNumber(writer, op.immediate);
+            } break;
         case OpType_jmp:
-        {
-            printf("$%+d", op.address);
-            
-        } break;
+            {
+                int32_t offset = (int32_t)op.address;
+                WriteText(writer, (offset < 0) ? "$" : "$+");
+                WriteNumber(writer, offset);
+            } break;
         default:
             {
-
             }
     }
 }
 
-void WriteToFile()
+/* Control Flow */
+
+ControlFlow ClassifyControlFlow(const Instruction &inst)
 {
-    /** TODO: Write to file */
+    if (inst.op == Op_RET)
+    {
+        return Flow_stop;
+    }
+
+    if (inst.operands[DEST].type == OpType_jmp)
+    {
+        return inst.op == Op_JMP ? Flow_jump : Flow_branch;
+    }
+
+    return inst.op == Op_JMP ? Flow_stop : Flow_next;
 }
 
-void WriteToConsole() 
+uint32_t FindLabel(const std::vector<uint32_t> &labels, uint32_t address)
 {
-    // Print start label 
-    for (int i = 0; i < DecodedInstIndex; i++)
-    {
-        Instruction inst = DecodedInstructions[i];
-        // Print mnemonic/operation 
-        printf("\t%s ", Mnemonics[inst.op]);
+    auto found = std::lower_bound(labels.begin(), labels.end(), address);
+    return (found != labels.end() && *found == address) ? (uint32_t)(found - labels.begin()) + 1 : 0;
+}
 
-        // If either operand type is immediate, we should print size 
-        if ((inst.operands[SRC].type == OpType_immediate || inst.operands[SRC].type == OpType_none) && inst.operands[DEST].type == OpType_effectiveAddrCalc)
-        {
-            printf("%s ", (inst.flags & Flags::Wide) == 0 ? "byte" : "word");
-        }
+void WriteHexByte(OutputWriter &writer, uint8_t value)
+{
+    constexpr char Digits[] = "0123456789ABCDEF";
+    char text[] = { '0', 'x', Digits[value >> 4], Digits[value & 0xF] };
+    WriteText(writer, std::string_view(text, sizeof(text)));
+}
 
-        // Print dest operand 
-        PrintOperand(inst.operands[1]);
+void WriteInstruction(OutputWriter &writer, const Instruction &inst, uint32_t label)
+{
+    WriteText(writer, "\t");
+    WriteText(writer, Mnemonics[inst.op]);
+    WriteText(writer, " ");
 
-        if (inst.operands[0].type != OpType_none)
-        {
-            printf(", ");
-        }   
+    // Memory operands without a register to imply the width need an explicit size
+    if ((inst.operands[SRC].type == OpType_immediate || inst.operands[SRC].type == OpType_none) && inst.operands[DEST].type == OpType_effectiveAddrCalc)
+    {
+        WriteText(writer, (inst.flags & Flags::Wide) == 0 ? "byte " : "word ");
+    }
 
-        // Print src operand 
-        PrintOperand(inst.operands[0]);
+    if (label && inst.operands[DEST].type == OpType_jmp)
+    {
+        WriteText(writer, "L");
+        WriteNumber(writer, (int32_t)label);
+    }
+    else
+    {
+        WriteOperand(writer, inst.operands[DEST]);
+    }
 
-        printf("\n");
+    if (inst.operands[DEST].type != OpType_none && inst.operands[SRC].type != OpType_none)
+    {
+        WriteText(writer, ", ");
     }
-}
 
-void Execute(Program &program)
-{
-    printf("Executing instructions...\n");
+    WriteOperand(writer, inst.operands[SRC]);
+    WriteText(writer, "\n");
 }
 
-#define DIRECT_ADDRESS 0b110
-void InterpretModRm(uint8_t mod, uint8_t rm, uint8_t w,  Operand &operand, SegmentedAddress &at)
+void WriteInstructions(InstructionRing &ring, OutputWriter &writer)
 {
-    switch(mod)
+    Instruction inst = {};
+    while (RingPop(ring, inst))
     {
-        case Memory_mode_no_disp:
-            {
-                operand.type = OpType_effectiveAddrCalc;
-                EffectiveAddrExpression exp = {};
-                DecodeEffectiveAddrExpression(mod, rm, exp, at);
-                exp.hasDisplacement = FALSE;
-                operand.expression = exp;
-            } break;
-        case Memory_mode_8_bit_disp:
-            {
-                operand.type = OpType_effectiveAddrCalc;
-                EffectiveAddrExpression exp = {};
-                DecodeEffectiveAddrExpression(mod, rm, exp, at);
-                int8_t disp  = (int8_t)ReadByteFromMemory(at);
-                IncrementAddress(at);
-                exp.displacement = (int16_t)disp;
-                exp.hasDisplacement = TRUE;
-                operand.expression = exp;
-            } break;
-        case Memory_mode_16_bit_disp:
-            {
-                operand.type = OpType_effectiveAddrCalc;
-                EffectiveAddrExpression exp = {};
-                DecodeEffectiveAddrExpression(mod, rm, exp, at);
-                exp.displacement = (int16_t)ReadWordFromMemory(at);
-                IncrementAddress(at);
-                IncrementAddress(at);
-                exp.hasDisplacement = TRUE;
-                operand.expression = exp;
-            } break;
-        case Register_mode:
-            {
-                operand.type = OpType_register;
-                operand.reg = {};
-                DecodeRegister(rm, w, operand.reg);	
-            } break;
+        WriteInstruction(writer, inst);
     }
 }
 
-/**
-* NOTE: Extracted from Decode to make Decode slightly easier to read. Provides no other function than that. 
-*/
-uint8_t ParseDataFromByte(Bits current, uint8_t &usedBits, SegmentedAddress &cursor) {
+/* Decoding */
+
+uint8_t ParseDataFromByte(const Machine &machine, Bits current, uint8_t &usedBits, SegmentedAddress &cursor) {
 
     uint8_t result = 0;
 
@@ -626,11 +405,11 @@ uint8_t ParseDataFromByte(Bits current, uint8_t &usedBits, SegmentedAddress &cur
     }
     else
     {
-        uint8_t byte = ReadByteFromMemory(cursor);
+        uint8_t byte = ReadByteFromMemory(machine, cursor);
         if (usedBits >= 8)
         {
             IncrementAddress(cursor);
-            byte = ReadByteFromMemory(cursor);
+            byte = ReadByteFromMemory(machine, cursor);
             usedBits = 0;
         }
         
@@ -640,9 +419,10 @@ uint8_t ParseDataFromByte(Bits current, uint8_t &usedBits, SegmentedAddress &cur
     return result;
 }
 
-
-Instruction Decode(Entry entry, SegmentedAddress &at)
+Instruction Decode(Machine &machine, Entry entry, SegmentedAddress &at)
 {
+    machine.stats.decodeAttempts++;
+
     Instruction inst = {};
     inst.address = ComputePhysicalAddress(at);
 
@@ -657,12 +437,13 @@ Instruction Decode(Entry entry, SegmentedAddress &at)
     while(!(entry.bits[bitsIndex].field == Op && entry.bits[bitsIndex].count == 0) && valid)
     {  
         Bits currentBits = entry.bits[bitsIndex];
-        uint8_t result = ParseDataFromByte(currentBits, usedBits, at);
+        uint8_t result = ParseDataFromByte(machine, currentBits, usedBits, at);
 
         // Just break out if the opcode extension does not match because we are decoding the wrong instruction entry.
         if (currentBits.field == OpExtension && (result != currentBits.value))
         {
             valid = false;
+            machine.stats.rejectedDecodes++;
         }
         
         extractedData[currentBits.field] = result;
@@ -681,7 +462,7 @@ Instruction Decode(Entry entry, SegmentedAddress &at)
         uint8_t s = extractedData[S_bit];
         
         inst.op = entry.mnemonic;
-        inst.flags |= w;
+        inst.flags |= w | (entry.flags & CSInc);
 
         if (HasField(hasBits, Mod_bit))
         {
@@ -690,7 +471,7 @@ Instruction Decode(Entry entry, SegmentedAddress &at)
 
             Operand op = {};
             uint8_t isWide = (entry.flags & RmIsWide) ? 1 : w;
-            InterpretModRm(mod, rm, isWide, op, at);
+            InterpretModRm(machine, ModRmTable.descriptors[isWide][(mod << 6) | rm], op, at);
             inst.operands[!d] = op;
         }
 
@@ -716,13 +497,13 @@ Instruction Decode(Entry entry, SegmentedAddress &at)
             bool isByte = (w == 1 && s == 1) || (w == 0);
             if (isByte)
             {
-                int8_t imm = (int8_t) ReadByteFromMemory(at);
+                int8_t imm = (int8_t) ReadByteFromMemory(machine, at);
                 IncrementAddress(at);
                 op.immediate = (int16_t) imm;
             }
             else
             {
-                op.immediate = (int16_t) ReadWordFromMemory(at);
+                op.immediate = (int16_t) ReadWordFromMemory(machine, at);
                 IncrementAddress(at);
                 IncrementAddress(at);
             }
@@ -734,7 +515,7 @@ Instruction Decode(Entry entry, SegmentedAddress &at)
         {
             EffectiveAddrExpression ex = {
                 .calculationType = Effective_addr_direct_address,
-                .displacement = (int16_t)ReadWordFromMemory(at)
+                .displacement = (int16_t)ReadWordFromMemory(machine, at)
             };
 
             IncrementAddress(at);
@@ -751,13 +532,13 @@ Instruction Decode(Entry entry, SegmentedAddress &at)
             int16_t displacement = 0;
             if (w == 1)
             {
-                displacement = (int16_t)ReadWordFromMemory(at);
+                displacement = (int16_t)ReadWordFromMemory(machine, at);
                 IncrementAddress(at);
                 IncrementAddress(at);
             }
             else
             {
-                int8_t inc = (int8_t)ReadByteFromMemory(at);
+                int8_t inc = (int8_t)ReadByteFromMemory(machine, at);
                 IncrementAddress(at);
                 displacement = (int16_t)inc;
             }
@@ -775,7 +556,7 @@ Instruction Decode(Entry entry, SegmentedAddress &at)
 
         if (HasField(hasBits, Data_bit))
         {
-            int8_t imm = (int8_t) ReadByteFromMemory(at);
+            int8_t imm = (int8_t) ReadByteFromMemory(machine, at);
             IncrementAddress(at);
             inst.operands[!d] = {
                 .type = OpType_immediate,
@@ -783,64 +564,2320 @@ Instruction Decode(Entry entry, SegmentedAddress &at)
             };
 
         }
+
+        inst.size = ComputePhysicalAddress(at) - inst.address;
     }
 
     return inst;
 }
 
-void Disassemble(Program &program)
-{	
-    CPU cpu = { 0 };
-
-    while (cpu.IP <= program.endAddr)
-    {
-        uint8_t currentByte = FetchNextInstructionByte(cpu);
-        Entry entry = {};
+/* Execution */
 
-        // Search Instruction table for matching instruction 
-        for (int i = 0; i < ArrayCount(InstructionTable); i++)
-        {
-            entry = InstructionTable[i];
+#if defined(_MSC_VER)
+#define SIM_FORCE_INLINE __forceinline
+#else
+#define SIM_FORCE_INLINE inline __attribute__((always_inline))
+#endif
 
-            if (entry.bits[0].value == (currentByte >> (8 - entry.bits[0].count)))
-            {
-                SegmentedAddress at = Create(cpu.segmentRegisters[CS], cpu.IP - 1);
-                Instruction result = Decode(entry, at);
-                if (result.op)
-                {
-                    DecodedInstructions[DecodedInstIndex] = result;
-                    DecodedInstIndex++;
-                    cpu.IP = at.offset;
-                    break;
-                }
-            }
+// GCC cross-jumps the identical dispatch tails of the threaded handlers back into a single indirect jump otherwise
+#if defined(__GNUC__) && !defined(__clang__)
+#define SIM_NO_TAIL_MERGE __attribute__((optimize("no-crossjumping")))
+#else
+#define SIM_NO_TAIL_MERGE
+#endif
 
-        }
+SIM_FORCE_INLINE uint16_t ReadRegister(const CPU &cpu, RegisterAccess reg)
+{
+    uint16_t value = cpu.registers[reg.index];
+    if (reg.offset == FULL_BITS)
+    {
+        return value;
     }
 
-    WriteToConsole();
+    return (reg.offset == HI_BITS) ? (value >> 8) : (value & 0xFF);
 }
 
-Program LoadProgramIntoMemory(std::string filePath)
+SIM_FORCE_INLINE void WriteRegister(CPU &cpu, RegisterAccess reg, uint16_t value)
 {
-    // Open binary file, at the end (ate)
-    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+    uint16_t &target = cpu.registers[reg.index];
+    if (reg.offset == FULL_BITS)
+    {
+        target = value;
+    }
+    else if (reg.offset == HI_BITS)
+    {
+        target = (target & 0x00FF) | (uint16_t)((value & 0xFF) << 8);
+    }
+    else
+    {
+        target = (target & 0xFF00) | (value & 0xFF);
+    }
+}
+
+/**
+ * Physical address of segment:offset for data accesses, which wrap at the top of the 1 MiB space like the 8086's 20
+ * address lines do.
+ */
+SIM_FORCE_INLINE uint32_t DataAddress(uint16_t segment, uint16_t offset)
+{
+    return (((uint32_t)segment << 4) + offset) & (MEMORY_SIZE - 1);
+}
 
-    if (!file.is_open() || errno == ENOENT)
+SIM_FORCE_INLINE uint16_t ReadData(const Machine &machine, SegmentedAddress at, bool wide)
+{
+    uint16_t value = machine.memory[DataAddress(at.segment, at.offset)];
+    if (wide)
     {
-        std::cerr << "ERROR: Could not open file. File does not exist.\n";
-        return { 0 };
+        value |= (uint16_t)(machine.memory[DataAddress(at.segment, (uint16_t)(at.offset + 1))] << 8);
     }
 
-    // Get file size
-    uint32_t length = static_cast<uint32_t>(file.tellg());
-    file.seekg(0, file.beg);
-    file.read(reinterpret_cast<char*>(Memory), length);
+    return value;
+}
 
-    Program program = {
-        .size=length,
-        .startAddr=0,
-        .endAddr=length - 1
+SIM_FORCE_INLINE void WriteData(Machine &machine, SegmentedAddress at, uint16_t value, bool wide)
+{
+    WriteByteToMemory(machine, DataAddress(at.segment, at.offset), (uint8_t)value);
+    if (wide)
+    {
+        WriteByteToMemory(machine, DataAddress(at.segment, (uint16_t)(at.offset + 1)), (uint8_t)(value >> 8));
+    }
+}
+
+/**
+ * Segment and offset an effective address refers to. Forms based on BP address the stack segment, the rest DS.
+ */
+SIM_FORCE_INLINE SegmentedAddress ResolveEffectiveAddress(const CPU &cpu, const EffectiveAddrExpression &expression)
+{
+    EffectiveAddressCalculation calculation = expression.calculationType;
+    uint16_t offset = (uint16_t)expression.displacement;
+    if (calculation != Effective_addr_direct_address)
+    {
+        offset += cpu.registers[expression.base.index];
+    }
+    if (calculation >= Effective_addr_bx_si && calculation <= Effective_addr_bp_di)
+    {
+        offset += cpu.registers[expression.index.index];
+    }
+
+    bool stackBased = calculation == Effective_addr_bp_si || calculation == Effective_addr_bp_di || calculation == Effective_addr_bp;
+    return Create(cpu.segmentRegisters[stackBased ? SS : DS], offset);
+}
+
+SIM_FORCE_INLINE uint16_t LoadOperand(const Machine &machine, const Operand &operand, bool wide)
+{
+    switch (operand.type)
+    {
+        case OpType_register:
+            {
+                return ReadRegister(machine.cpu, operand.reg);
+            }
+        case OpType_effectiveAddrCalc:
+            {
+                return ReadData(machine, ResolveEffectiveAddress(machine.cpu, operand.expression), wide);
+            }
+        case OpType_immediate:
+            {
+                return wide ? (uint16_t)operand.immediate : (uint16_t)(operand.immediate & 0xFF);
+            }
+        default:
+            {
+                return 0;
+            }
+    }
+}
+
+SIM_FORCE_INLINE void StoreOperand(Machine &machine, const Operand &operand, uint16_t value, bool wide)
+{
+    if (operand.type == OpType_register)
+    {
+        WriteRegister(machine.cpu, operand.reg, value);
+    }
+    else if (operand.type == OpType_effectiveAddrCalc)
+    {
+        WriteData(machine, ResolveEffectiveAddress(machine.cpu, operand.expression), value, wide);
+    }
+}
+
+/**
+ * a + b + carry at the instruction's width. `keepCarry` leaves CF alone, as INC does.
+ */
+SIM_FORCE_INLINE uint16_t AddWithFlags(CPU &cpu, uint16_t a, uint16_t b, uint16_t carry, bool wide, bool keepCarry = false)
+{
+    uint32_t mask = wide ? 0xFFFF : 0xFF;
+    a &= mask;
+    b &= mask;
+
+    uint32_t result = (uint32_t)a + b + carry;
+    RecordFlags(cpu, FlagsOp_add, a, b, result, wide, keepCarry);
+    return (uint16_t)(result & mask);
+}
+
+/**
+ * a - b - borrow at the instruction's width. `keepCarry` leaves CF alone, as DEC does. A borrow wraps the unmasked
+ * result above the width, the same place a carry lands.
+ */
+SIM_FORCE_INLINE uint16_t SubtractWithFlags(CPU &cpu, uint16_t a, uint16_t b, uint16_t borrow, bool wide, bool keepCarry = false)
+{
+    uint32_t mask = wide ? 0xFFFF : 0xFF;
+    a &= mask;
+    b &= mask;
+
+    uint32_t result = (uint32_t)a - b - borrow;
+    RecordFlags(cpu, FlagsOp_subtract, a, b, result, wide, keepCarry);
+    return (uint16_t)(result & mask);
+}
+
+constexpr bool IsConditionalJump(Operation op)
+{
+    switch (op)
+    {
+        case Op_JZ: case Op_JNZ: case Op_JNGE: case Op_JGE: case Op_JNG: case Op_JG: case Op_JNAE: case Op_JAE:
+        case Op_JNA: case Op_JA: case Op_JPE: case Op_JPO: case Op_JO: case Op_JNO: case Op_JS: case Op_JNS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+SIM_FORCE_INLINE bool JumpTaken(Operation op, uint16_t flags)
+{
+    bool carry = flags & Flag_carry;
+    bool zero = flags & Flag_zero;
+    bool sign = flags & Flag_sign;
+    bool overflow = flags & Flag_overflow;
+    bool parity = flags & Flag_parity;
+
+    switch (op)
+    {
+        case Op_JZ: return zero;
+        case Op_JNZ: return !zero;
+        case Op_JNGE: return sign != overflow;
+        case Op_JGE: return sign == overflow;
+        case Op_JNG: return zero || sign != overflow;
+        case Op_JG: return !zero && sign == overflow;
+        case Op_JNAE: return carry;
+        case Op_JAE: return !carry;
+        case Op_JNA: return carry || zero;
+        case Op_JA: return !carry && !zero;
+        case Op_JPE: return parity;
+        case Op_JPO: return !parity;
+        case Op_JO: return overflow;
+        case Op_JNO: return !overflow;
+        case Op_JS: return sign;
+        case Op_JNS: return !sign;
+        default: return false;
+    }
+}
+
+SIM_FORCE_INLINE void TakeJump(CPU &cpu, const Instruction &inst)
+{
+    // The operand is relative to the start of the instruction and IP is already past it
+    cpu.IP = (uint16_t)(cpu.IP - inst.size + inst.operands[DEST].address);
+}
+
+SIM_FORCE_INLINE uint16_t PopWord(Machine &machine)
+{
+    CPU &cpu = machine.cpu;
+    uint16_t sp = cpu.registers[Register_sp];
+    uint16_t value = ReadData(machine, Create(cpu.segmentRegisters[SS], sp), true);
+    cpu.registers[Register_sp] += 2;
+
+    // A POP takes the word off the return stack too, as long as it's the word the stack has on top
+    ReturnStack &returns = machine.blocks.returns;
+    if (machine.blocks.active && returns.depth && returns.entries[returns.top & (RETURN_STACK_SIZE - 1)].sp == sp)
+    {
+        returns.top--;
+        returns.depth--;
+    }
+
+    return value;
+}
+
+SIM_FORCE_INLINE void PushReturnEntry(Machine &machine, uint16_t sp, uint16_t ip)
+{
+    if (!machine.blocks.active)
+    {
+        return;
+    }
+
+    ReturnStack &returns = machine.blocks.returns;
+    uint32_t slot = BlockSlot(ComputePhysicalAddress(Create(machine.cpu.segmentRegisters[CS], ip)));
+    returns.entries[++returns.top & (RETURN_STACK_SIZE - 1)] = { .sp = sp, .slot = slot };
+    returns.depth = std::min<uint32_t>(returns.depth + 1, RETURN_STACK_SIZE);
+}
+
+/**
+ * Executes one instruction of a known op. Every op is its own instantiation so the dispatch loops can jump straight to
+ * the code for it.
+ */
+template <Operation Op>
+SIM_FORCE_INLINE bool ExecuteOperation(Machine &machine, const Instruction &inst)
+{
+    CPU &cpu = machine.cpu;
+    const Operand &dest = inst.operands[DEST];
+    const Operand &src = inst.operands[SRC];
+    bool wide = inst.flags & Flags::Wide;
+
+    if constexpr (Op == Op_MOV)
+    {
+        StoreOperand(machine, dest, LoadOperand(machine, src, wide), wide);
+    }
+    else if constexpr (Op == Op_XCHG)
+    {
+        uint16_t value = LoadOperand(machine, dest, wide);
+        StoreOperand(machine, dest, LoadOperand(machine, src, wide), wide);
+        StoreOperand(machine, src, value, wide);
+    }
+    else if constexpr (Op == Op_ADD || Op == Op_ADC)
+    {
+        uint16_t carry = (Op == Op_ADC) ? CarryFlag(cpu) : 0;
+        uint16_t a = LoadOperand(machine, dest, wide);
+        StoreOperand(machine, dest, AddWithFlags(cpu, a, LoadOperand(machine, src, wide), carry, wide), wide);
+    }
+    else if constexpr (Op == Op_SUB || Op == Op_SBB || Op == Op_CMP)
+    {
+        uint16_t borrow = (Op == Op_SBB) ? CarryFlag(cpu) : 0;
+        uint16_t a = LoadOperand(machine, dest, wide);
+        uint16_t result = SubtractWithFlags(cpu, a, LoadOperand(machine, src, wide), borrow, wide);
+        if constexpr (Op != Op_CMP)
+        {
+            StoreOperand(machine, dest, result, wide);
+        }
+    }
+    else if constexpr (Op == Op_INC)
+    {
+        StoreOperand(machine, dest, AddWithFlags(cpu, LoadOperand(machine, dest, wide), 1, 0, wide, true), wide);
+    }
+    else if constexpr (Op == Op_DEC)
+    {
+        StoreOperand(machine, dest, SubtractWithFlags(cpu, LoadOperand(machine, dest, wide), 1, 0, wide, true), wide);
+    }
+    else if constexpr (Op == Op_NEG)
+    {
+        // 0 - x borrows exactly when x isn't 0, which is the CF NEG defines
+        StoreOperand(machine, dest, SubtractWithFlags(cpu, 0, LoadOperand(machine, dest, wide), 0, wide), wide);
+    }
+    else if constexpr (Op == Op_PUSH)
+    {
+        // SP drops before the operand is read, so PUSH SP stores the new SP like the 8086 does
+        cpu.registers[Register_sp] -= 2;
+        SegmentedAddress top = Create(cpu.segmentRegisters[SS], cpu.registers[Register_sp]);
+        uint16_t value = LoadOperand(machine, dest, true);
+        WriteData(machine, top, value, true);
+        PushReturnEntry(machine, top.offset, value);
+    }
+    else if constexpr (Op == Op_POP)
+    {
+        StoreOperand(machine, dest, PopWord(machine), true);
+    }
+    else if constexpr (Op == Op_JMP)
+    {
+        if (dest.type == OpType_jmp)
+        {
+            TakeJump(cpu, inst);
+        }
+        else if (!(inst.flags & CSInc))
+        {
+            cpu.IP = LoadOperand(machine, dest, true);
+        }
+        else if (dest.type == OpType_effectiveAddrCalc)
+        {
+            // Intersegment indirect jumps load IP and then CS from a doubleword in memory
+            SegmentedAddress pointer = ResolveEffectiveAddress(cpu, dest.expression);
+            cpu.IP = ReadData(machine, pointer, true);
+            cpu.segmentRegisters[CS] = ReadData(machine, Create(pointer.segment, (uint16_t)(pointer.offset + 2)), true);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    else if constexpr (IsConditionalJump(Op))
+    {
+        if (JumpTaken(Op, MaterializeFlags(cpu)))
+        {
+            TakeJump(cpu, inst);
+        }
+    }
+    else if constexpr (Op == Op_LOOP || Op == Op_LOOPZ || Op == Op_LOOPNZ)
+    {
+        uint16_t count = --cpu.registers[Register_c];
+        if (count != 0 && (Op == Op_LOOP || (Op == Op_LOOPZ) == ((MaterializeFlags(cpu) & Flag_zero) != 0)))
+        {
+            TakeJump(cpu, inst);
+        }
+    }
+    else if constexpr (Op == Op_JCXZ)
+    {
+        if (cpu.registers[Register_c] == 0)
+        {
+            TakeJump(cpu, inst);
+        }
+    }
+    else if constexpr (Op == Op_RET)
+    {
+        // Read before PopWord drops the entry. NextBlock enters the predicted slot only if it holds the block at the
+        // popped IP, and counts the hit or miss there.
+        BlockCache &cache = machine.blocks;
+        ReturnEntry expected = cache.returns.entries[cache.returns.top & (RETURN_STACK_SIZE - 1)];
+        if (cache.active && cache.returns.depth && expected.sp == cpu.registers[Register_sp])
+        {
+            cache.predicted = expected.slot;
+        }
+        else if (cache.active)
+        {
+            cache.stats.returnMisses++;
+        }
+
+        cpu.IP = PopWord(machine);
+
+        if (src.type == OpType_immediate)
+        {
+            cpu.registers[Register_sp] += (uint16_t)src.immediate;
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+void StartExecution(Machine &machine, const Program &program)
+{
+    CPU &cpu = machine.cpu;
+    cpu = {};
+    for (uint16_t &segment : cpu.segmentRegisters)
+    {
+        segment = program.loadAddress.segment;
+    }
+    cpu.IP = program.loadAddress.offset;
+    machine.blocks.returns = {};
+
+    if (!machine.blocks.slots.empty())
+    {
+        machine.blocks.stats.evictions += machine.blocks.live;
+        FlushBlockCache(machine.blocks);
+    }
+}
+
+bool ExecuteInstruction(Machine &machine, const Instruction &inst)
+{
+    switch (inst.op)
+    {
+#define INST(mnemonic, ...) case Op_##mnemonic: return ExecuteOperation<Op_##mnemonic>(machine, inst);
+#define INST_ALT(...)
+#include "InstructionTable.inl"
+#undef INST
+#undef INST_ALT
+        default:
+            return false;
+    }
+}
+
+/**
+ * Decodes the instruction at CS:IP and moves IP past it.
+ */
+SIM_FORCE_INLINE ExecutionStop FetchInstruction(Machine &machine, const Program &program, Instruction &inst)
+{
+    CPU &cpu = machine.cpu;
+    SegmentedAddress at = Create(cpu.segmentRegisters[CS], cpu.IP);
+    uint32_t address = ComputePhysicalAddress(at);
+    if (program.size == 0 || address < program.startAddr || address > program.endAddr)
+    {
+        return Stop_programEnd;
+    }
+
+    uint8_t entry = LookupEntry(machine, at);
+    if (entry == NO_ENTRY)
+    {
+        return Stop_undecodable;
+    }
+
+    inst = SpecializedDecoders[entry](machine, at);
+    if (!inst.op)
+    {
+        return Stop_undecodable;
+    }
+
+    cpu.IP = at.offset;
+    return Stop_none;
+}
+
+/**
+ * Returns the cached block starting at CS:IP, decoding and caching it on a miss. Returns null with `stop` set when
+ * CS:IP is outside the program or nothing decodes there.
+ */
+const CachedBlock *FindBlock(Machine &machine, const Program &program, ExecutionStop &stop)
+{
+    BlockCache &cache = machine.blocks;
+    SegmentedAddress at = Create(machine.cpu.segmentRegisters[CS], machine.cpu.IP);
+    uint32_t address = ComputePhysicalAddress(at);
+    if (program.size == 0 || address < program.startAddr || address > program.endAddr)
+    {
+        stop = Stop_programEnd;
+        return nullptr;
+    }
+
+    CachedBlock *slot = &cache.slots[BlockSlot(address)];
+    if (slot->address == address)
+    {
+        cache.stats.hits++;
+        return slot;
+    }
+
+    cache.stats.misses++;
+    if (cache.used + BLOCK_MAX_INSTRUCTIONS > cache.instructions.size())
+    {
+        cache.stats.flushes++;
+        cache.stats.evictions += cache.live;
+        FlushBlockCache(cache);
+    }
+
+    CachedBlock block = {
+        .address = address,
+        .first = cache.used,
+        .links = { NO_BLOCK, NO_BLOCK }
+    };
+
+    while (block.count < BLOCK_MAX_INSTRUCTIONS)
+    {
+        uint8_t entry = LookupEntry(machine, at);
+        if (entry == NO_ENTRY)
+        {
+            break;
+        }
+
+        Instruction inst = SpecializedDecoders[entry](machine, at);
+        if (!inst.op)
+        {
+            break;
+        }
+
+        cache.instructions[cache.used++] = inst;
+        block.count++;
+        block.size += inst.size;
+        cache.stats.translated++;
+
+        uint32_t next = ComputePhysicalAddress(at);
+        if (ClassifyControlFlow(inst) != Flow_next || next > program.endAddr)
+        {
+            break;
+        }
+    }
+
+    if (block.count == 0)
+    {
+        stop = Stop_undecodable;
+        return nullptr;
+    }
+
+    if (slot->address != NO_BLOCK)
+    {
+        TrackCodePages(cache, *slot, false);
+        cache.stats.evictions++;
+        cache.live--;
+    }
+
+    *slot = block;
+    TrackCodePages(cache, block, true);
+    cache.live++;
+    return slot;
+}
+
+/**
+ * The block to run next once the current one is done. A return prediction or a link from the finished block is used
+ * when its slot holds the block at CS:IP; otherwise FindBlock looks it up, and the finished block is linked to it.
+ */
+SIM_FORCE_INLINE const CachedBlock *NextBlock(Machine &machine, const Program &program, ExecutionStop &stop)
+{
+    BlockCache &cache = machine.blocks;
+    uint32_t address = ComputePhysicalAddress(Create(machine.cpu.segmentRegisters[CS], machine.cpu.IP));
+
+    uint32_t predicted = cache.predicted;
+    cache.predicted = NO_BLOCK;
+    if (predicted != NO_BLOCK)
+    {
+        if (cache.slots[predicted].address == address)
+        {
+            cache.stats.returnHits++;
+            cache.previous = predicted;
+            return &cache.slots[predicted];
+        }
+
+        cache.stats.returnMisses++;
+    }
+
+    if (cache.previous != NO_BLOCK)
+    {
+        for (uint32_t link : cache.slots[cache.previous].links)
+        {
+            if (link != NO_BLOCK && cache.slots[link].address == address)
+            {
+                cache.stats.chained++;
+                cache.previous = link;
+                return &cache.slots[link];
+            }
+        }
+    }
+
+    const CachedBlock *block = FindBlock(machine, program, stop);
+    if (!block)
+    {
+        return nullptr;
+    }
+
+    // FindBlock may have flushed, which also forgets the previous block
+    uint32_t slot = (uint32_t)(block - cache.slots.data());
+    if (cache.previous != NO_BLOCK)
+    {
+        CachedBlock &from = cache.slots[cache.previous];
+        if (from.address != NO_BLOCK && ClassifyControlFlow(cache.instructions[from.first + from.count - 1]) != Flow_stop)
+        {
+            from.links[address == from.address + from.size] = slot;
+        }
+    }
+
+    cache.previous = slot;
+    return block;
+}
+
+/**
+ * Produces the instruction at CS:IP and moves IP past it, either decoding it on the spot or taking it from the block
+ * cache.
+ */
+template <bool Cached>
+SIM_FORCE_INLINE ExecutionStop FetchNext(Machine &machine, const Program &program, Instruction &inst)
+{
+    if constexpr (!Cached)
+    {
+        return FetchInstruction(machine, program, inst);
+    }
+    else
+    {
+        BlockCursor &cursor = machine.blocks.current;
+        if (cursor.next == cursor.end)
+        {
+            ExecutionStop stop = Stop_none;
+            const CachedBlock *block = NextBlock(machine, program, stop);
+            if (!block)
+            {
+                return stop;
+            }
+
+            cursor.next = &machine.blocks.instructions[block->first];
+            cursor.end = cursor.next + block->count;
+        }
+
+        inst = *cursor.next++;
+        machine.cpu.IP += inst.size;
+        return Stop_none;
+    }
+}
+
+template <bool Cached>
+ExecutionResult RunSwitch(Machine &machine, const Program &program, uint64_t limit)
+{
+    ExecutionResult result = {};
+    Instruction inst = {};
+    while (result.instructions < limit)
+    {
+        result.stop = FetchNext<Cached>(machine, program, inst);
+        if (result.stop != Stop_none)
+        {
+            return result;
+        }
+
+        if (!ExecuteInstruction(machine, inst))
+        {
+            machine.cpu.IP -= inst.size;
+            result.stop = Stop_unsupported;
+            return result;
+        }
+
+        result.instructions++;
+    }
+
+    result.stop = Stop_limit;
+    return result;
+}
+
+#if SIM_COMPUTED_GOTO
+/**
+ * Same loop as RunSwitch, but every handler ends in its own copy of the fetch and indirect jump. The branch predictor
+ * then learns which op tends to follow which, instead of sharing a single jump for every op.
+ */
+template <bool Cached>
+SIM_NO_TAIL_MERGE ExecutionResult RunThreaded(Machine &machine, const Program &program, uint64_t limit)
+{
+    static const void *Handlers[Op_count] = {
+        &&Handler_none,
+#define INST(mnemonic, ...) &&Handler_##mnemonic,
+#define INST_ALT(...)
+#include "InstructionTable.inl"
+#undef INST
+#undef INST_ALT
+    };
+
+    ExecutionResult result = {};
+    Instruction inst = {};
+
+#define DISPATCH()                                                      \
+    if (result.instructions == limit)                                   \
+    {                                                                   \
+        result.stop = Stop_limit;                                       \
+        return result;                                                  \
+    }                                                                   \
+    result.stop = FetchNext<Cached>(machine, program, inst);    \
+    if (result.stop != Stop_none)                                       \
+    {                                                                   \
+        return result;                                                  \
+    }                                                                   \
+    goto *Handlers[inst.op]
+
+    DISPATCH();
+
+#define INST(mnemonic, ...)                                             \
+    Handler_##mnemonic:                                                 \
+    if (!ExecuteOperation<Op_##mnemonic>(machine, inst))                \
+    {                                                                   \
+        goto Handler_none;                                              \
+    }                                                                   \
+    result.instructions++;                                              \
+    DISPATCH();
+#define INST_ALT(...)
+#include "InstructionTable.inl"
+#undef INST
+#undef INST_ALT
+
+#undef DISPATCH
+
+Handler_none:
+    machine.cpu.IP -= inst.size;
+    result.stop = Stop_unsupported;
+    return result;
+}
+#endif
+
+ExecutionResult Run(Machine &machine, const Program &program, uint64_t limit, DispatchStrategy dispatch, bool useBlockCache)
+{
+    if (useBlockCache && machine.blocks.slots.empty())
+    {
+        InitBlockCache(machine.blocks, BLOCK_CACHE_BUDGET);
+    }
+
+    machine.blocks.active = useBlockCache;
+
+    // A limited run stops mid-block and the next one resumes there, but only while CS:IP is still the cursor's next
+    // instruction. The caller may have moved IP in between, and an unsupported instruction leaves IP behind the cursor.
+    BlockCache &cache = machine.blocks;
+    uint32_t address = ComputePhysicalAddress(Create(machine.cpu.segmentRegisters[CS], machine.cpu.IP));
+    if (cache.current.next != cache.current.end && cache.current.next->address != address)
+    {
+        cache.current = {};
+        cache.previous = NO_BLOCK;
+        cache.predicted = NO_BLOCK;
+    }
+
+#if SIM_COMPUTED_GOTO
+    if (dispatch == Dispatch_threaded)
+    {
+        return useBlockCache ? RunThreaded<true>(machine, program, limit) : RunThreaded<false>(machine, program, limit);
+    }
+#endif
+
+    return useBlockCache ? RunSwitch<true>(machine, program, limit) : RunSwitch<false>(machine, program, limit);
+}
+
+void WriteExecutionState(OutputWriter &output, CPU &cpu, const ExecutionResult &result)
+{
+    constexpr const char *SegmentNames[Segment_count] = { "CS", "SS", "DS", "ES" };
+    constexpr struct {
+        uint16_t flag;
+        char letter;
+    } FlagLetters[] = {
+        { Flag_carry, 'C' }, { Flag_parity, 'P' }, { Flag_auxCarry, 'A' }, { Flag_zero, 'Z' }, { Flag_sign, 'S' },
+        { Flag_overflow, 'O' }
+    };
+
+    char line[128];
+    auto writeLine = [&](int length) {
+        WriteText(output, std::string_view(line, (size_t)std::clamp(length, 0, (int)sizeof(line) - 1)));
+    };
+
+    MaterializeFlags(cpu);
+    writeLine(snprintf(line, sizeof(line), "Executed %llu instructions, stopped at %04X:%04X (%s)\n\n",
+        (unsigned long long)result.instructions, cpu.segmentRegisters[CS], cpu.IP, StopNames[result.stop].data()));
+
+    WriteText(output, "Final registers:\n");
+    for (int i = 0; i < Register_count; i++)
+    {
+        writeLine(snprintf(line, sizeof(line), "\t%s: 0x%04X (%u)\n", RegisterNames[i][FULL_BITS].data(),
+            cpu.registers[i], cpu.registers[i]));
+    }
+    for (int i = 0; i < Segment_count; i++)
+    {
+        writeLine(snprintf(line, sizeof(line), "\t%s: 0x%04X\n", SegmentNames[i], cpu.segmentRegisters[i]));
+    }
+    writeLine(snprintf(line, sizeof(line), "\tIP: 0x%04X\n", cpu.IP));
+
+    WriteText(output, "\tflags: ");
+    for (const auto &flag : FlagLetters)
+    {
+        if (cpu.flags & flag.flag)
+        {
+            WriteText(output, std::string_view(&flag.letter, 1));
+        }
+    }
+    WriteText(output, "\n");
+}
+
+void WriteBlockCacheStats(OutputWriter &output, const BlockCacheStats &stats)
+{
+    WriteText(output, "Block cache: ");
+    WriteCount(output, stats.hits);
+    WriteText(output, " hits, ");
+    WriteCount(output, stats.misses);
+    WriteText(output, " misses, ");
+    WriteCount(output, stats.evictions);
+    WriteText(output, " evictions, ");
+    WriteCount(output, stats.flushes);
+    WriteText(output, " flushes, ");
+    WriteCount(output, stats.invalidations);
+    WriteText(output, " invalidated by writes, ");
+    WriteCount(output, stats.translated);
+    WriteText(output, " instructions translated\n");
+
+    WriteText(output, "Block chaining: ");
+    WriteCount(output, stats.chained);
+    WriteText(output, " blocks entered through links, ");
+    WriteCount(output, stats.returnHits);
+    WriteText(output, " RETs predicted, ");
+    WriteCount(output, stats.returnMisses);
+    WriteText(output, " mispredicted\n");
+}
+
+void Execute(Machine &machine, Program &program)
+{
+    StartExecution(machine, program);
+    ExecutionResult result = Run(machine, program, EXECUTE_INSTRUCTION_LIMIT);
+
+    std::unique_ptr<OutputWriter> output = std::make_unique<OutputWriter>();
+    OpenOutput(*output, STDOUT_FD);
+    WriteExecutionState(*output, machine.cpu, result);
+    WriteText(*output, "\n");
+    WriteBlockCacheStats(*output, machine.blocks.stats);
+    FlushOutput(*output);
+}
+
+/* Disassembly */
+
+void Disassemble(Machine &machine, Program &program, OutputWriter &output)
+{	
+    CPU &cpu = machine.cpu;
+    cpu = {};
+    cpu.segmentRegisters[CS] = program.loadAddress.segment;
+    cpu.IP = program.loadAddress.offset;
+
+    // IP is only 16 bits, so walk images past 64 KiB by sliding CS forward whenever IP nears the end of its segment
+    while (program.size > 0 && (uint32_t)ComputePhysicalAddress(Create(cpu.segmentRegisters[CS], cpu.IP)) <= program.endAddr)
+    {
+        if (cpu.IP >= SEGMENT_WRAP_MARGIN)
+        {
+            SegmentedAddress next = NormalizeAddress(Create(cpu.segmentRegisters[CS], cpu.IP));
+            cpu.segmentRegisters[CS] = next.segment;
+            cpu.IP = next.offset;
+        }
+
+        SegmentedAddress at = Create(cpu.segmentRegisters[CS], cpu.IP);
+        FetchNextInstructionByte(machine);
+
+        uint8_t entry = LookupEntry(machine, at);
+        if (entry != NO_ENTRY)
+        {
+            Instruction result = SpecializedDecoders[entry](machine, at);
+            if (result.op)
+            {
+                RingPush(machine.decoded, result);
+                machine.stats.instructions++;
+                cpu.IP = at.offset;
+            }
+        }
+
+        // Hand finished chunks to the formatter as soon as the ring fills so output starts before decoding finishes
+        if (RingIsFull(machine.decoded))
+        {
+            WriteInstructions(machine.decoded, output);
+        }
+    }
+
+    WriteInstructions(machine.decoded, output);
+    FlushOutput(output);
+}
+
+/* Parallel Disassembly */
+
+bool DecodeAtPhysical(Machine &machine, uint32_t address, Instruction &inst)
+{
+    SegmentedAddress at = Create(address >> 4, address & 0xF);
+    uint8_t entry = LookupEntry(machine, at);
+    if (entry == NO_ENTRY)
+    {
+        return false;
+    }
+
+    inst = SpecializedDecoders[entry](machine, at);
+    return inst.op != None;
+}
+
+/**
+ * A slice of the image disassembled by one thread. A sweep can enter a chunk up to MAX_INSTRUCTION_LENGTH - 1 bytes
+ * past its start, depending on where the previous chunk's last instruction ends, so each entry offset is tried.
+ */
+struct DisassemblyChunk {
+    uint32_t start;
+    uint32_t end;                               // One past the chunk's last byte
+    uint8_t exits[MAX_INSTRUCTION_LENGTH];      // Sweep entering at start + e leaves at end + exits[e]
+    uint8_t entry;                              // Entry offset the serial sweep uses, picked by the merge
+    std::string listing;
+    DecodeStats stats;
+};
+
+void ScanInstructionLengths(const uint8_t *bytes, uint32_t count, uint8_t *lengths)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint8_t length = InstructionLength(bytes + i);
+        lengths[i] = length ? length : 1;
+    }
+}
+
+/**
+ * Finds the exit for every entry offset of a chunk. The length at every byte is scanned up front, so the sweeps only
+ * chain through that array. Only the first sweep runs the whole chunk; the others stop as soon as they land on one of
+ * its instruction boundaries, after which both streams are the same.
+ */
+void ScanChunkExits(Machine &machine, DisassemblyChunk &chunk)
+{
+    uint32_t size = chunk.end - chunk.start;
+    std::vector<uint8_t> lengths(size);
+    ScanInstructionLengths(machine.memory + chunk.start, size, lengths.data());
+
+    std::vector<bool> boundaries(size + MAX_INSTRUCTION_LENGTH, false);
+
+    uint32_t address = chunk.start;
+    while (address < chunk.end)
+    {
+        boundaries[address - chunk.start] = true;
+        address += lengths[address - chunk.start];
+    }
+    chunk.exits[0] = (uint8_t)(address - chunk.end);
+
+    for (uint8_t entry = 1; entry < MAX_INSTRUCTION_LENGTH; entry++)
+    {
+        address = chunk.start + entry;
+        while (address < chunk.end && !boundaries[address - chunk.start])
+        {
+            address += lengths[address - chunk.start];
+        }
+
+        chunk.exits[entry] = (address < chunk.end) ? chunk.exits[0] : (uint8_t)(address - chunk.end);
+    }
+}
+
+/**
+ * Disassembles a chunk from its merged entry offset into the chunk's own listing.
+ */
+void DisassembleChunk(Machine &machine, DisassemblyChunk &chunk)
+{
+    std::unique_ptr<OutputWriter> writer = std::make_unique<OutputWriter>();
+    OpenCapture(*writer, &chunk.listing);
+
+    uint32_t address = chunk.start + chunk.entry;
+    while (address < chunk.end)
+    {
+        Instruction inst = {};
+        if (DecodeAtPhysical(machine, address, inst))
+        {
+            machine.stats.instructions++;
+            WriteInstruction(*writer, inst);
+            address += inst.size;
+        }
+        else
+        {
+            address++;
+        }
+    }
+
+    FlushOutput(*writer);
+    chunk.stats = machine.stats;
+}
+
+/**
+ * Runs `work` on every chunk, one thread each. Every worker gets its own machine that borrows the caller's address space
+ * read-only, so decoder state and counters aren't shared.
+ */
+template<typename Work>
+void RunOnThreads(const Machine &machine, std::vector<DisassemblyChunk> &chunks, Work work)
+{
+    std::vector<std::thread> threads;
+    for (DisassemblyChunk &chunk : chunks)
+    {
+        threads.emplace_back([&machine, &chunk, work]() {
+            std::unique_ptr<Machine> worker = std::make_unique<Machine>();
+            worker->memory = machine.memory;
+            work(*worker, chunk);
+        });
+    }
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void DisassembleParallel(Machine &machine, Program &program, OutputWriter &output, uint32_t threadCount)
+{
+    uint32_t chunkCount = std::min<uint32_t>(threadCount, program.size / MIN_PARALLEL_CHUNK);
+    if (chunkCount < 2)
+    {
+        Disassemble(machine, program, output);
+        return;
+    }
+
+    std::vector<DisassemblyChunk> chunks(chunkCount);
+    uint32_t chunkSize = program.size / chunkCount;
+    for (uint32_t i = 0; i < chunkCount; i++)
+    {
+        chunks[i].start = program.startAddr + i * chunkSize;
+        chunks[i].end = (i + 1 == chunkCount) ? program.endAddr + 1 : chunks[i].start + chunkSize;
+    }
+
+    RunOnThreads(machine, chunks, ScanChunkExits);
+
+    chunks[0].entry = 0;
+    for (uint32_t i = 1; i < chunkCount; i++)
+    {
+        chunks[i].entry = chunks[i - 1].exits[chunks[i - 1].entry];
+    }
+
+    RunOnThreads(machine, chunks, DisassembleChunk);
+
+    for (const DisassemblyChunk &chunk : chunks)
+    {
+        WriteText(output, chunk.listing);
+        AccumulateStats(machine.stats, chunk.stats);
+    }
+
+    FlushOutput(output);
+}
+
+/* Recursive Disassembly */
+
+void DisassembleRecursive(Machine &machine, Program &program, OutputWriter &output)
+{
+    // Length of the instruction starting at each byte of the image, 0 where no reached instruction starts
+    std::vector<uint8_t> lengths(program.size, 0);
+    std::vector<uint32_t> targets;
+    std::vector<uint32_t> worklist;
+
+    if (program.size > 0)
+    {
+        worklist.push_back(program.startAddr);
+    }
+
+    while (!worklist.empty())
+    {
+        uint32_t address = worklist.back();
+        worklist.pop_back();
+
+        while (address >= program.startAddr && address <= program.endAddr && lengths[address - program.startAddr] == 0)
+        {
+            Instruction inst = {};
+            if (!DecodeAtPhysical(machine, address, inst) || address + inst.size - 1 > program.endAddr)
+            {
+                break;
+            }
+
+            machine.stats.instructions++;
+            lengths[address - program.startAddr] = (uint8_t)inst.size;
+
+            ControlFlow flow = ClassifyControlFlow(inst);
+            if (flow == Flow_branch || flow == Flow_jump)
+            {
+                uint32_t target = JumpTarget(inst, program.loadAddress.segment);
+                targets.push_back(target);
+                worklist.push_back(target);
+            }
+
+            if (flow == Flow_jump || flow == Flow_stop)
+            {
+                break;
+            }
+
+            address += inst.size;
+        }
+    }
+
+    // A start inside an earlier instruction can't be listed in place. It's set aside to be written as a comment after
+    // that instruction, and loses its label, so only listed starts get labels.
+    std::vector<uint32_t> overlapped;
+    for (uint32_t offset = 0; offset < program.size; )
+    {
+        uint8_t length = lengths[offset];
+        if (length == 0)
+        {
+            offset++;
+            continue;
+        }
+
+        for (uint32_t i = 1; i < length; i++)
+        {
+            if (lengths[offset + i] != 0)
+            {
+                overlapped.push_back(offset + i);
+                lengths[offset + i] = 0;
+            }
+        }
+        offset += length;
+    }
+
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+    targets.erase(std::remove_if(targets.begin(), targets.end(), [&](uint32_t target) {
+        return target < program.startAddr || target > program.endAddr || lengths[target - program.startAddr] == 0;
+    }), targets.end());
+
+    size_t nextLabel = 0;
+    size_t nextOverlapped = 0;
+    for (uint32_t offset = 0; offset < program.size; )
+    {
+        uint32_t address = program.startAddr + offset;
+        if (lengths[offset] == 0)
+        {
+            WriteText(output, "\tdb ");
+            for (uint32_t count = 0; count < DATA_BYTES_PER_LINE && offset < program.size && lengths[offset] == 0; count++)
+            {
+                if (count > 0)
+                {
+                    WriteText(output, ", ");
+                }
+                WriteHexByte(output, machine.memory[program.startAddr + offset]);
+                offset++;
+            }
+            WriteText(output, "\n");
+            continue;
+        }
+
+        if (nextLabel < targets.size() && targets[nextLabel] == address)
+        {
+            nextLabel++;
+            WriteText(output, "L");
+            WriteNumber(output, (int32_t)nextLabel);
+            WriteText(output, ":\n");
+        }
+
+        Instruction inst = {};
+        DecodeAtPhysical(machine, address, inst);
+        WriteInstruction(output, inst, (inst.operands[DEST].type == OpType_jmp) ?
+            FindLabel(targets, JumpTarget(inst, program.loadAddress.segment)) : 0);
+        offset += lengths[offset];
+
+        while (nextOverlapped < overlapped.size() && overlapped[nextOverlapped] < offset)
+        {
+            uint32_t start = program.startAddr + overlapped[nextOverlapped++];
+            WriteText(output, "; also reached at +");
+            WriteNumber(output, (int32_t)(start - address));
+            WriteText(output, ", inside the instruction above:\n;");
+            DecodeAtPhysical(machine, start, inst);
+            WriteInstruction(output, inst);
+        }
+    }
+
+    FlushOutput(output);
+}
+
+/* Columnar Export */
+
+/**
+ * Values are stored a byte at a time, least significant first, so files are little endian whatever the host is.
+ */
+template<typename T>
+void AppendValue(std::vector<uint8_t> &bytes, T value)
+{
+    std::make_unsigned_t<T> bits = (std::make_unsigned_t<T>)value;
+    for (size_t i = 0; i < sizeof(T); i++)
+    {
+        bytes.push_back((uint8_t)(bits >> (8 * i)));
+    }
+}
+
+template<typename T>
+T LoadValue(const uint8_t *bytes)
+{
+    std::make_unsigned_t<T> bits = 0;
+    for (size_t i = 0; i < sizeof(T); i++)
+    {
+        bits |= (std::make_unsigned_t<T>)((std::make_unsigned_t<T>)bytes[i] << (8 * i));
+    }
+    return (T)bits;
+}
+
+template<typename T>
+T ColumnValue(const ColumnarView &view, ColumnId id, uint64_t index)
+{
+    return LoadValue<T>(view.columns[id] + index * sizeof(T));
+}
+
+void AppendHeader(std::vector<uint8_t> &bytes, const ColumnarHeader &header)
+{
+    AppendValue(bytes, header.magic);
+    AppendValue(bytes, header.version);
+    AppendValue(bytes, header.columnCount);
+    AppendValue(bytes, header.instructionCount);
+}
+
+ColumnarHeader LoadHeader(const uint8_t *bytes)
+{
+    return {
+        .magic = LoadValue<uint32_t>(bytes),
+        .version = LoadValue<uint16_t>(bytes + 4),
+        .columnCount = LoadValue<uint16_t>(bytes + 6),
+        .instructionCount = LoadValue<uint64_t>(bytes + 8)
+    };
+}
+
+void AppendDescriptor(std::vector<uint8_t> &bytes, const ColumnDescriptor &descriptor)
+{
+    AppendValue(bytes, descriptor.id);
+    AppendValue(bytes, descriptor.width);
+    AppendValue(bytes, descriptor.offset);
+}
+
+ColumnDescriptor LoadDescriptor(const uint8_t *bytes)
+{
+    return {
+        .id = LoadValue<uint32_t>(bytes),
+        .width = LoadValue<uint32_t>(bytes + 4),
+        .offset = LoadValue<uint64_t>(bytes + 8)
+    };
+}
+
+inline uint64_t AlignColumn(uint64_t offset)
+{
+    return (offset + COLUMNAR_ALIGNMENT - 1) & ~(uint64_t)(COLUMNAR_ALIGNMENT - 1);
+}
+
+void AppendInstruction(InstructionColumns &columns, const Instruction &inst)
+{
+    uint8_t registers[2] = {};
+    uint8_t addressing = 0;
+    int32_t displacement = 0;
+    int16_t immediate = 0;
+
+    for (int i = SRC; i <= DEST; i++)
+    {
+        const Operand &op = inst.operands[i];
+        switch (op.type)
+        {
+            case OpType_register:
+                {
+                    registers[i] = op.reg.index | (op.reg.offset << PACKED_REGISTER_OFFSET_SHIFT);
+                } break;
+            case OpType_effectiveAddrCalc:
+                {
+                    addressing = op.expression.calculationType | (op.expression.hasDisplacement ? PACKED_HAS_DISPLACEMENT : 0);
+                    displacement = op.expression.displacement;
+                } break;
+            case OpType_immediate:
+                {
+                    immediate = op.immediate;
+                } break;
+            case OpType_jmp:
+                {
+                    displacement = (int32_t)op.address;
+                } break;
+            default:
+                {
+                }
+        }
+    }
+
+    AppendValue<uint32_t>(columns.columns[Column_address], inst.address);
+    AppendValue<uint8_t>(columns.columns[Column_size], (uint8_t)inst.size);
+    AppendValue<uint8_t>(columns.columns[Column_op], inst.op);
+    AppendValue<uint16_t>(columns.columns[Column_flags], inst.flags);
+    AppendValue<uint8_t>(columns.columns[Column_destKind], (uint8_t)inst.operands[DEST].type);
+    AppendValue<uint8_t>(columns.columns[Column_srcKind], (uint8_t)inst.operands[SRC].type);
+    AppendValue<uint8_t>(columns.columns[Column_destRegister], registers[DEST]);
+    AppendValue<uint8_t>(columns.columns[Column_srcRegister], registers[SRC]);
+    AppendValue<uint8_t>(columns.columns[Column_addressing], addressing);
+    AppendValue<int32_t>(columns.columns[Column_displacement], displacement);
+    AppendValue<int16_t>(columns.columns[Column_immediate], immediate);
+    columns.count++;
+}
+
+void WriteInstructionColumns(const InstructionColumns &columns, OutputWriter &output)
+{
+    static const char Padding[COLUMNAR_ALIGNMENT] = {};
+
+    std::vector<uint8_t> table;
+    AppendHeader(table, {
+        .magic = COLUMNAR_MAGIC,
+        .version = COLUMNAR_VERSION,
+        .columnCount = Column_count,
+        .instructionCount = columns.count
+    });
+
+    uint64_t position = sizeof(ColumnarHeader) + sizeof(ColumnDescriptor) * Column_count;
+    uint64_t offset = AlignColumn(position);
+    for (uint32_t id = 0; id < Column_count; id++)
+    {
+        AppendDescriptor(table, {
+            .id = id,
+            .width = ColumnWidths[id],
+            .offset = offset
+        });
+        offset = AlignColumn(offset + columns.columns[id].size());
+    }
+    WriteText(output, std::string_view((const char *)table.data(), table.size()));
+
+    for (const std::vector<uint8_t> &column : columns.columns)
+    {
+        WriteText(output, std::string_view(Padding, AlignColumn(position) - position));
+        WriteText(output, std::string_view((const char *)column.data(), column.size()));
+        position = AlignColumn(position) + column.size();
+    }
+
+    FlushOutput(output);
+}
+
+void ExportColumns(Machine &machine, Program &program, OutputWriter &output)
+{
+    std::unique_ptr<InstructionColumns> columns = std::make_unique<InstructionColumns>();
+
+    uint32_t address = program.startAddr;
+    while (program.size > 0 && address <= program.endAddr)
+    {
+        Instruction inst = {};
+        if (DecodeAtPhysical(machine, address, inst))
+        {
+            machine.stats.instructions++;
+            AppendInstruction(*columns, inst);
+            address += inst.size;
+        }
+        else
+        {
+            address++;
+        }
+    }
+
+    WriteInstructionColumns(*columns, output);
+}
+
+bool OpenColumnarView(ColumnarView &view, const uint8_t *data, size_t size)
+{
+    if (size < sizeof(ColumnarHeader))
+    {
+        return false;
+    }
+
+    ColumnarHeader header = LoadHeader(data);
+    if (header.magic != COLUMNAR_MAGIC || header.version != COLUMNAR_VERSION ||
+        header.columnCount > (size - sizeof(header)) / sizeof(ColumnDescriptor))
+    {
+        return false;
+    }
+
+    view = { .count = header.instructionCount };
+    for (uint32_t i = 0; i < header.columnCount; i++)
+    {
+        ColumnDescriptor descriptor = LoadDescriptor(data + sizeof(header) + i * sizeof(ColumnDescriptor));
+
+        // Columns added by later writers are skipped
+        if (descriptor.id >= Column_count)
+        {
+            continue;
+        }
+
+        if (descriptor.width != ColumnWidths[descriptor.id] || descriptor.offset > size ||
+            header.instructionCount > (size - descriptor.offset) / descriptor.width)
+        {
+            return false;
+        }
+
+        view.columns[descriptor.id] = data + descriptor.offset;
+    }
+
+    for (const uint8_t *column : view.columns)
+    {
+        if (!column)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+Instruction ReadColumnarInstruction(const ColumnarView &view, uint64_t index)
+{
+    Instruction inst = {
+        .op = (Operation)ColumnValue<uint8_t>(view, Column_op, index),
+        .address = ColumnValue<uint32_t>(view, Column_address, index),
+        .size = ColumnValue<uint8_t>(view, Column_size, index),
+        .flags = ColumnValue<uint16_t>(view, Column_flags, index)
+    };
+
+    uint8_t kinds[2] = { ColumnValue<uint8_t>(view, Column_srcKind, index), ColumnValue<uint8_t>(view, Column_destKind, index) };
+    uint8_t registers[2] = { ColumnValue<uint8_t>(view, Column_srcRegister, index), ColumnValue<uint8_t>(view, Column_destRegister, index) };
+    uint8_t addressing = ColumnValue<uint8_t>(view, Column_addressing, index);
+    int32_t displacement = ColumnValue<int32_t>(view, Column_displacement, index);
+
+    for (int i = SRC; i <= DEST; i++)
+    {
+        Operand &op = inst.operands[i];
+        op.type = (OperandType)kinds[i];
+        switch (op.type)
+        {
+            case OpType_register:
+                {
+                    op.reg = { (uint8_t)(registers[i] & 0b111), (uint8_t)(registers[i] >> PACKED_REGISTER_OFFSET_SHIFT) };
+                } break;
+            case OpType_effectiveAddrCalc:
+                {
+                    // Files come from outside, so an out of range calculation type must not index past the table
+                    EffectiveAddressCalculation calculationType = (EffectiveAddressCalculation)(addressing & 0b1111);
+                    if (calculationType >= Effective_addr_count)
+                    {
+                        calculationType = Effective_addr_direct_address;
+                    }
+
+                    op.expression = {
+                        .calculationType = calculationType,
+                        .base = EffectiveAddressRegisters[calculationType][0],
+                        .index = EffectiveAddressRegisters[calculationType][1],
+                        .hasDisplacement = (uint8_t)((addressing & PACKED_HAS_DISPLACEMENT) != 0),
+                        .displacement = (int16_t)displacement
+                    };
+                } break;
+            case OpType_immediate:
+                {
+                    op.immediate = ColumnValue<int16_t>(view, Column_immediate, index);
+                } break;
+            case OpType_jmp:
+                {
+                    op.address = (uint32_t)displacement;
+                } break;
+            default:
+                {
+                }
+        }
+    }
+
+    return inst;
+}
+
+/* Stream Generation */
+
+inline uint16_t NextRandom(uint32_t &seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return (uint16_t)(seed >> 16);
+}
+
+/**
+ * Appends `count` random bytes to an encoding and returns them as a little endian value.
+ */
+static uint16_t AppendRandomBytes(uint8_t count, uint32_t &seed, uint8_t *out, uint8_t &length)
+{
+    uint16_t value = 0;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        out[length] = (uint8_t)NextRandom(seed);
+        value |= (uint16_t)(out[length++] << (8 * i));
+    }
+
+    return value;
+}
+
+uint8_t EncodeRandomInstruction(uint8_t entry, uint32_t &seed, uint8_t *out, Instruction &inst)
+{
+    const Bits &opcode = InstructionTable[entry].bits[0];
+    const EntryLayout &layout = EntryLayouts[entry];
+
+    memset(out, 0, MAX_INSTRUCTION_LENGTH);
+    out[0] = (uint8_t)(opcode.value << (8 - opcode.count));
+
+    uint8_t values[Field_count] = {};
+    for (int f = OpExtension; f < Field_count; f++)
+    {
+        const FieldLayout &field = layout.fields[f];
+        if (!field.present)
+        {
+            continue;
+        }
+
+        if (field.isConstant)
+        {
+            values[f] = field.value;
+            continue;
+        }
+
+        values[f] = (f == OpExtension) ? field.value : (uint8_t)(NextRandom(seed) & field.mask);
+        out[field.byte] |= values[f] << field.shift;
+    }
+
+    // The operands follow from the chosen fields with the same rules Decode() applies, and the trailing bytes are
+    // drawn in the order it consumes them
+    uint8_t d = values[D_bit];
+    uint8_t w = values[W_bit];
+    uint8_t s = values[S_bit];
+
+    inst = {};
+    inst.op = InstructionTable[entry].mnemonic;
+    inst.flags = w | (InstructionTable[entry].flags & CSInc);
+
+    uint8_t length = layout.opcodeBytes;
+    if (layout.fields[Mod_bit].present)
+    {
+        uint8_t isWide = (InstructionTable[entry].flags & RmIsWide) ? 1 : w;
+        const ModRmDescriptor &descriptor = ModRmTable.descriptors[isWide][(values[Mod_bit] << 6) | values[Rm_bit]];
+
+        Operand &rm = inst.operands[!d];
+        if (descriptor.type == OpType_register)
+        {
+            rm.type = OpType_register;
+            rm.reg = descriptor.rm;
+        }
+        else
+        {
+            uint16_t displacement = AppendRandomBytes(descriptor.displacementSize, seed, out, length);
+            rm.type = OpType_effectiveAddrCalc;
+            rm.expression = {
+                .calculationType = descriptor.calculationType,
+                .base = descriptor.base,
+                .index = descriptor.index,
+                .hasDisplacement = descriptor.hasDisplacement,
+                .displacement = (descriptor.displacementSize == 1) ? (int16_t)(int8_t)displacement : (int16_t)displacement
+            };
+        }
+    }
+    if (layout.fields[Reg_bit].present)
+    {
+        inst.operands[d].type = OpType_register;
+        inst.operands[d].reg = RegisterTable[w][values[Reg_bit]];
+    }
+    if (layout.fields[Imm_bit].present)
+    {
+        bool isByte = (w == 1 && s == 1) || w == 0;
+        uint16_t immediate = AppendRandomBytes(isByte ? 1 : 2, seed, out, length);
+        inst.operands[SRC].type = OpType_immediate;
+        inst.operands[SRC].immediate = isByte ? (int16_t)(int8_t)immediate : (int16_t)immediate;
+    }
+    if (layout.fields[Addr_bit].present)
+    {
+        inst.operands[!d].type = OpType_effectiveAddrCalc;
+        inst.operands[!d].expression = {
+            .calculationType = Effective_addr_direct_address,
+            .displacement = (int16_t)AppendRandomBytes(2, seed, out, length)
+        };
+    }
+    if (layout.fields[Displacement_bit].present)
+    {
+        uint16_t displacement = AppendRandomBytes(w ? 2 : 1, seed, out, length);
+        int16_t offset = w ? (int16_t)displacement : (int16_t)(int8_t)displacement;
+        inst.operands[DEST].type = OpType_jmp;
+        inst.operands[DEST].address = (uint32_t)offset + length;
+        inst.flags |= IPInc;
+    }
+    if (layout.fields[Data_bit].present)
+    {
+        inst.operands[!d].type = OpType_immediate;
+        inst.operands[!d].immediate = (int16_t)(int8_t)AppendRandomBytes(1, seed, out, length);
+    }
+
+    inst.size = length;
+    return length;
+}
+
+GeneratedStream GenerateStream(Machine &machine, uint32_t size, const uint32_t weights[Op_count], uint32_t seed)
+{
+    std::vector<uint8_t> entries[Op_count];
+    for (uint8_t i = 0; i < ArrayCount(InstructionTable); i++)
+    {
+        entries[InstructionTable[i].mnemonic].push_back(i);
+    }
+
+    // Running weight totals, searched with a random value to pick a mnemonic
+    std::vector<Operation> ops;
+    std::vector<uint64_t> totals;
+    uint64_t total = 0;
+    for (int op = None + 1; op < Op_count; op++)
+    {
+        if (weights[op] > 0 && !entries[op].empty())
+        {
+            total += weights[op];
+            ops.push_back((Operation)op);
+            totals.push_back(total);
+        }
+    }
+
+    GeneratedStream stream = {};
+    uint32_t retries = 0;
+    while (total > 0 && stream.size + MAX_INSTRUCTION_LENGTH <= size && retries < GENERATOR_MAX_RETRIES)
+    {
+        uint64_t pick = (((uint64_t)NextRandom(seed) << 16) | NextRandom(seed)) % total;
+        Operation op = ops[std::upper_bound(totals.begin(), totals.end(), pick) - totals.begin()];
+        uint8_t entry = entries[op][NextRandom(seed) % entries[op].size()];
+
+        uint32_t address = stream.size;
+        Instruction inst = {};
+        uint8_t length = EncodeRandomInstruction(entry, seed, machine.memory + address, inst);
+
+        // A few encodings the table allows are claimed by another entry or decode to another length
+        SegmentedAddress at = Create(address >> 4, address & 0xF);
+        if (LookupEntry(machine, at) != entry || InstructionLength(machine.memory + address) != length)
+        {
+            retries++;
+            continue;
+        }
+
+        retries = 0;
+        inst.address = address;
+        stream.instructions.push_back({ .address = address, .entry = entry, .instruction = inst });
+        stream.size += length;
+    }
+
+    // Clear whatever a rejected last attempt left past the end of the stream
+    memset(machine.memory + stream.size, 0, MAX_INSTRUCTION_LENGTH);
+    return stream;
+}
+
+/* Encoding */
+
+/**
+ * The entry LookupEntry() would pick for an encoding, without needing it in a machine's memory.
+ */
+inline uint8_t EntryForBytes(const uint8_t *bytes)
+{
+    const OpcodeCandidates &candidates = OpcodeTable.candidates[bytes[0]];
+    if (!candidates.usesExtension)
+    {
+        return (candidates.count == 0) ? NO_ENTRY : candidates.entries[0];
+    }
+
+    return candidates.extensions[(bytes[1] >> 3) & 0b111];
+}
+
+inline bool FitsInByte(int32_t value)
+{
+    return value >= -128 && value <= 127;
+}
+
+/**
+ * The field value selecting `reg` for width `w`, or 0xFF if no value does.
+ */
+inline uint8_t RegisterFieldFor(RegisterAccess reg, uint8_t w)
+{
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        if (RegisterTable[w][i].index == reg.index && RegisterTable[w][i].offset == reg.offset)
+        {
+            return i;
+        }
+    }
+
+    return 0xFF;
+}
+
+/**
+ * Encodes `inst` with one table entry and one choice of D, S and displacement width. Returns false when the operands
+ * don't fit that combination.
+ */
+bool EncodeWithEntry(const Instruction &inst, uint8_t entryIndex, uint8_t d, uint8_t s, bool wideDisplacement,
+    Encoding &encoding)
+{
+    // r/m values for each effective address calculation when mod is not register mode
+    constexpr uint8_t RmForCalculation[Effective_addr_count] = { 0b110, 0b000, 0b001, 0b010, 0b011, 0b100, 0b101, 0b111, 0b110 };
+
+    const Entry &entry = InstructionTable[entryIndex];
+    const EntryLayout &layout = EntryLayouts[entryIndex];
+    const FieldLayout *fields = layout.fields;
+
+    uint8_t values[Field_count] = {};
+    values[OpExtension] = fields[OpExtension].value;
+    values[D_bit] = d;
+    values[S_bit] = s;
+    values[W_bit] = fields[W_bit].isConstant ? fields[W_bit].value : (uint8_t)(inst.flags & Wide);
+    uint8_t w = values[W_bit];
+
+    // Decode() sets the flags from W and the entry and marks relative jumps, anything else can't come back out of the
+    // decoder
+    uint16_t expectedFlags = w | (entry.flags & CSInc) | (fields[Displacement_bit].present ? IPInc : 0);
+    if (inst.flags != expectedFlags || (fields[W_bit].present == 0 && w != 0))
+    {
+        return false;
+    }
+
+    bool bound[2] = {};
+    auto bind = [&](int operand) {
+        bool free = !bound[operand];
+        bound[operand] = true;
+        return free;
+    };
+
+    uint8_t displacementSize = 0;
+    int16_t displacement = 0;
+    if (fields[Mod_bit].present)
+    {
+        const Operand &op = inst.operands[!d];
+        uint8_t isWide = (entry.flags & RmIsWide) ? 1 : w;
+        if (!bind(!d))
+        {
+            return false;
+        }
+
+        if (op.type == OpType_register)
+        {
+            values[Mod_bit] = Register_mode;
+            values[Rm_bit] = RegisterFieldFor(op.reg, isWide);
+        }
+        else if (op.type == OpType_effectiveAddrCalc)
+        {
+            const EffectiveAddrExpression &expression = op.expression;
+            displacement = expression.displacement;
+            values[Rm_bit] = RmForCalculation[expression.calculationType];
+
+            if (expression.calculationType == Effective_addr_direct_address)
+            {
+                values[Mod_bit] = Memory_mode_no_disp;
+                displacementSize = 2;
+                if (expression.hasDisplacement)
+                {
+                    return false;
+                }
+            }
+            else if (!expression.hasDisplacement)
+            {
+                values[Mod_bit] = Memory_mode_no_disp;
+                if (expression.calculationType == Effective_addr_bp || displacement != 0)
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                bool narrow = FitsInByte(displacement) && !wideDisplacement;
+                values[Mod_bit] = narrow ? Memory_mode_8_bit_disp : Memory_mode_16_bit_disp;
+                displacementSize = narrow ? 1 : 2;
+            }
+        }
+        else
+        {
+            return false;
+        }
+
+        if (values[Rm_bit] == 0xFF || (fields[Mod_bit].isConstant && fields[Mod_bit].value != values[Mod_bit]) ||
+            (fields[Rm_bit].isConstant && fields[Rm_bit].value != values[Rm_bit]))
+        {
+            return false;
+        }
+    }
+
+    if (fields[Reg_bit].present)
+    {
+        const Operand &op = inst.operands[d];
+        if (!bind(d) || op.type != OpType_register)
+        {
+            return false;
+        }
+
+        values[Reg_bit] = RegisterFieldFor(op.reg, w);
+        if (values[Reg_bit] == 0xFF || (fields[Reg_bit].isConstant && fields[Reg_bit].value != values[Reg_bit]))
+        {
+            return false;
+        }
+    }
+
+    // Fixed fields first, then the trailing bytes in the order Decode() reads them
+    memset(encoding.bytes, 0, sizeof(encoding.bytes));
+    encoding.bytes[0] = (uint8_t)(entry.bits[0].value << (8 - entry.bits[0].count));
+    for (int f = OpExtension; f < Field_count; f++)
+    {
+        if (fields[f].present && !fields[f].isConstant)
+        {
+            encoding.bytes[fields[f].byte] |= (values[f] & fields[f].mask) << fields[f].shift;
+        }
+    }
+
+    uint8_t length = layout.opcodeBytes;
+    auto append = [&](int16_t value, uint8_t size) {
+        encoding.bytes[length++] = (uint8_t)value;
+        if (size == 2)
+        {
+            encoding.bytes[length++] = (uint8_t)((uint16_t)value >> 8);
+        }
+    };
+
+    if (displacementSize)
+    {
+        append(displacement, displacementSize);
+    }
+
+    if (fields[Imm_bit].present)
+    {
+        const Operand &op = inst.operands[SRC];
+        bool isByte = (w == 1 && s == 1) || (w == 0);
+        if (!bind(SRC) || op.type != OpType_immediate || (isByte && !FitsInByte(op.immediate)))
+        {
+            return false;
+        }
+        append(op.immediate, isByte ? 1 : 2);
+    }
+
+    if (fields[Addr_bit].present)
+    {
+        const Operand &op = inst.operands[!d];
+        if (!bind(!d) || op.type != OpType_effectiveAddrCalc ||
+            op.expression.calculationType != Effective_addr_direct_address || op.expression.hasDisplacement)
+        {
+            return false;
+        }
+        append(op.expression.displacement, 2);
+    }
+
+    if (fields[Displacement_bit].present)
+    {
+        const Operand &op = inst.operands[DEST];
+        uint8_t size = w ? 2 : 1;
+        int32_t target = (int32_t)op.address - (length + size);
+        if (!bind(DEST) || op.type != OpType_jmp || (w ? (target < INT16_MIN || target > INT16_MAX) : !FitsInByte(target)))
+        {
+            return false;
+        }
+        append((int16_t)target, size);
+    }
+
+    if (fields[Data_bit].present)
+    {
+        const Operand &op = inst.operands[!d];
+        if (!bind(!d) || op.type != OpType_immediate || !FitsInByte(op.immediate))
+        {
+            return false;
+        }
+        append(op.immediate, 1);
+    }
+
+    for (int i = SRC; i <= DEST; i++)
+    {
+        if (!bound[i] && inst.operands[i].type != OpType_none)
+        {
+            return false;
+        }
+    }
+
+    encoding.length = length;
+    return EntryForBytes(encoding.bytes) == entryIndex;
+}
+
+void EnumerateEncodings(const Instruction &inst, Encodings &encodings)
+{
+    encodings.count = 0;
+
+    for (uint8_t entry = 0; entry < ArrayCount(InstructionTable); entry++)
+    {
+        if (InstructionTable[entry].mnemonic != inst.op)
+        {
+            continue;
+        }
+
+        const FieldLayout *fields = EntryLayouts[entry].fields;
+        uint8_t variableD = fields[D_bit].present && !fields[D_bit].isConstant;
+        uint8_t variableS = fields[S_bit].present && !fields[S_bit].isConstant;
+
+        for (uint8_t d = 0; d <= variableD; d++)
+        {
+            for (uint8_t s = 0; s <= variableS; s++)
+            {
+                for (bool wideDisplacement : { false, true })
+                {
+                    Encoding encoding = {};
+                    uint8_t dValue = fields[D_bit].isConstant ? fields[D_bit].value : d;
+                    if (!EncodeWithEntry(inst, entry, dValue, s, wideDisplacement, encoding))
+                    {
+                        continue;
+                    }
+
+                    bool duplicate = false;
+                    for (uint32_t i = 0; i < encodings.count && !duplicate; i++)
+                    {
+                        duplicate = encodings.items[i].length == encoding.length &&
+                            memcmp(encodings.items[i].bytes, encoding.bytes, encoding.length) == 0;
+                    }
+
+                    if (!duplicate && encodings.count < MAX_ENCODINGS)
+                    {
+                        encodings.items[encodings.count++] = encoding;
+                    }
+                }
+            }
+        }
+    }
+}
+
+uint8_t EncodeInstruction(const Instruction &inst, uint8_t *out)
+{
+    Encodings encodings;
+    EnumerateEncodings(inst, encodings);
+
+    const Encoding *shortest = nullptr;
+    for (uint32_t i = 0; i < encodings.count; i++)
+    {
+        if (!shortest || encodings.items[i].length < shortest->length)
+        {
+            shortest = &encodings.items[i];
+        }
+    }
+
+    if (!shortest)
+    {
+        return 0;
+    }
+
+    memcpy(out, shortest->bytes, shortest->length);
+    return shortest->length;
+}
+
+void WriteBytes(OutputWriter &writer, const uint8_t *bytes, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        WriteText(writer, " ");
+        WriteHexByte(writer, bytes[i]);
+    }
+}
+
+VerifyResult VerifyImage(Machine &machine, Program &program, OutputWriter &report)
+{
+    VerifyResult result = {};
+
+    uint32_t address = program.startAddr;
+    while (program.size > 0 && address <= program.endAddr)
+    {
+        const uint8_t *original = machine.memory + address;
+
+        Instruction inst = {};
+        if (!DecodeAtPhysical(machine, address, inst))
+        {
+            result.undecodedBytes++;
+            address++;
+            continue;
+        }
+
+        result.instructions++;
+
+        Encodings encodings;
+        EnumerateEncodings(inst, encodings);
+
+        const Encoding *chosen = nullptr;
+        for (uint32_t i = 0; i < encodings.count && !chosen; i++)
+        {
+            if (encodings.items[i].length == inst.size && memcmp(encodings.items[i].bytes, original, inst.size) == 0)
+            {
+                chosen = &encodings.items[i];
+            }
+        }
+
+        // Nothing reproduces the image, so fall back to the canonical encoding to show what the encoder would emit
+        Encoding canonical = {};
+        if (!chosen)
+        {
+            canonical.length = EncodeInstruction(inst, canonical.bytes);
+            chosen = &canonical;
+        }
+
+        if (chosen->length != inst.size || memcmp(chosen->bytes, original, inst.size) != 0)
+        {
+            if (result.mismatches < VERIFY_REPORT_LIMIT)
+            {
+                char text[16];
+                WriteText(report, std::string_view(text, snprintf(text, sizeof(text), "0x%05X", address)));
+                WriteText(report, ": image");
+                WriteBytes(report, original, inst.size);
+                WriteText(report, ", encoded");
+                WriteBytes(report, chosen->bytes, chosen->length);
+                WriteInstruction(report, inst);
+            }
+            result.mismatches++;
+        }
+
+        address += inst.size;
+    }
+
+    FlushOutput(report);
+    return result;
+}
+
+/* Program Loading */
+
+bool ParseSegmentedAddress(const char *text, SegmentedAddress &at)
+{
+    char *end = nullptr;
+    unsigned long segment = strtoul(text, &end, 16);
+    if (end == text || *end != ':' || segment > 0xFFFF)
+    {
+        return false;
+    }
+
+    const char *offsetText = end + 1;
+    unsigned long offset = strtoul(offsetText, &end, 16);
+    if (end == offsetText || *end != '\0' || offset > 0xFFFF)
+    {
+        return false;
+    }
+
+    at = Create((uint16_t)segment, (uint16_t)offset);
+    return true;
+}
+
+#ifndef _WIN32
+/**
+ * Zeroes a machine's address space by mapping fresh anonymous pages over it. POSIX leaves the old pages unspecified when
+ * a MAP_FIXED mapping fails, so the space is then replaced as a whole, and if even that fails the machine is left
+ * without memory rather than pointing at pages that may be gone.
+ */
+static bool ResetMemory(Machine &machine)
+{
+    if (mmap(machine.memory, MEMORY_MAPPING_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED)
+    {
+        return true;
+    }
+
+    munmap(machine.memory, MEMORY_MAPPING_SIZE);
+    void *space = mmap(nullptr, MEMORY_MAPPING_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    machine.memory = (space == MAP_FAILED) ? nullptr : static_cast<uint8_t*>(space);
+    return machine.memory != nullptr;
+}
+#endif
+
+/**
+ * Reports a load failure as one line, either to stderr or into the caller's `error` so batch workers don't interleave.
+ */
+static Program LoadFailed(std::string *error, const std::string &message)
+{
+    std::string line = "ERROR: " + message + "\n";
+    if (error)
+    {
+        *error = std::move(line);
+    }
+    else
+    {
+        std::cerr << line;
+    }
+    return {};
+}
+
+Program LoadProgramIntoMemory(Machine &machine, std::string filePath, SegmentedAddress loadAddress, std::string *error)
+{
+    uint32_t start = ComputePhysicalAddress(loadAddress);
+    if (!machine.memory)
+    {
+        return LoadFailed(error, "No simulator memory to load " + filePath + " into");
+    }
+
+#ifdef _WIN32
+    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        return LoadFailed(error, "Could not open file " + filePath);
+    }
+
+    uint64_t length = static_cast<uint64_t>(file.tellg());
+#else
+    int fd = open(filePath.c_str(), O_RDONLY);
+    struct stat info = {};
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return LoadFailed(error, "Could not open file " + filePath);
+    }
+
+    uint64_t length = static_cast<uint64_t>(info.st_size);
+#endif
+
+    if (start >= MEMORY_SIZE || length > MEMORY_SIZE - start)
+    {
+#ifndef _WIN32
+        close(fd);
+#endif
+        char above[8] = {};
+        std::to_chars(above, above + sizeof(above) - 1, start, 16);
+        return LoadFailed(error, filePath + " is " + std::to_string(length) +
+            " bytes and does not fit in the 1 MiB address space above " + above + "h");
+    }
+
+#ifdef _WIN32
+    uint8_t *memory = machine.memory;
+    memset(memory, 0, MEMORY_MAPPING_SIZE);
+    file.seekg(0, file.beg);
+    if (!file.read(reinterpret_cast<char*>(memory + start), length))
+    {
+        return LoadFailed(error, "Could not read file " + filePath);
+    }
+#else
+    // Mapping fresh anonymous pages over the old ones drops the previous image without touching every byte
+    if (!ResetMemory(machine))
+    {
+        close(fd);
+        return LoadFailed(error, "Could not reset memory for " + filePath);
+    }
+
+    bool loaded = (length == 0);
+    if (!loaded && start % sysconf(_SC_PAGESIZE) == 0)
+    {
+        loaded = mmap(machine.memory + start, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED;
+
+        // The failed mapping may have taken the pages under it along, so start over from a whole address space
+        if (!loaded && !ResetMemory(machine))
+        {
+            close(fd);
+            return LoadFailed(error, "Could not reset memory for " + filePath);
+        }
+    }
+    uint8_t *memory = machine.memory;
+
+    // Load addresses that are not page aligned can't be mapped, fall back to reading the image in
+    uint64_t copied = 0;
+    while (!loaded)
+    {
+        ssize_t result = pread(fd, memory + start + copied, length - copied, (off_t)copied);
+        if (result <= 0)
+        {
+            break;
+        }
+
+        copied += (uint64_t)result;
+        loaded = (copied == length);
+    }
+
+    close(fd);
+
+    if (!loaded)
+    {
+        return LoadFailed(error, "Could not read file " + filePath);
+    }
+#endif
+
+    Program program = {
+        .size=(uint32_t)length,
+        .startAddr=start,
+        .endAddr=start + (uint32_t)length - 1,
+        .loadAddress=loadAddress,
+        .loaded=true
     };
     return program; 
 }
+
+/* Batch Mode */
+
+/**
+ * One image of a batch. Workers fill in the listing or load error and the stats, then set `done` so the writer can
+ * emit it in order.
+ */
+struct BatchJob {
+    std::string path;
+    std::string listing;
+    std::string error;      // Why the image could not be loaded
+    DecodeStats stats;
+    bool loaded;
+    std::atomic<bool> done;
+};
+
+/**
+ * A worker's share of the batch. The owner takes jobs from the front while idle workers steal from the back, so a run
+ * of slow images queued on one worker gets spread over the others.
+ */
+struct WorkQueue {
+    std::mutex lock;
+    std::deque<uint32_t> jobs;
+};
+
+bool TakeJob(std::vector<WorkQueue> &queues, uint32_t self, uint32_t &job)
+{
+    {
+        std::lock_guard<std::mutex> guard(queues[self].lock);
+        if (!queues[self].jobs.empty())
+        {
+            job = queues[self].jobs.front();
+            queues[self].jobs.pop_front();
+            return true;
+        }
+    }
+
+    for (uint32_t i = 1; i < queues.size(); i++)
+    {
+        WorkQueue &victim = queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.back();
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Loads one image on the calling worker's machine and either disassembles it or runs it and captures the final state.
+ */
+void RunBatchJob(Machine &machine, BatchJob &job, bool execute, bool recursive, SegmentedAddress loadAddress)
+{
+    machine.stats = {};
+    Program program = LoadProgramIntoMemory(machine, job.path, loadAddress, &job.error);
+    job.loaded = program.loaded;
+
+    if (job.loaded)
+    {
+        std::unique_ptr<OutputWriter> writer = std::make_unique<OutputWriter>();
+        OpenCapture(*writer, &job.listing);
+
+        if (execute)
+        {
+            // The worker's cache outlives the image, so count only this run
+            StartExecution(machine, program);
+            machine.blocks.stats = {};
+            ExecutionResult result = Run(machine, program, EXECUTE_INSTRUCTION_LIMIT);
+            WriteExecutionState(*writer, machine.cpu, result);
+            WriteText(*writer, "\n");
+            WriteBlockCacheStats(*writer, machine.blocks.stats);
+            FlushOutput(*writer);
+        }
+        else if (recursive)
+        {
+            DisassembleRecursive(machine, program, *writer);
+        }
+        else
+        {
+            Disassemble(machine, program, *writer);
+        }
+    }
+
+    job.stats = machine.stats;
+}
+
+bool CollectBatchPaths(const std::string &source, std::vector<std::string> &paths)
+{
+    std::error_code error;
+    if (std::filesystem::is_directory(source, error))
+    {
+        for (const auto &entry : std::filesystem::directory_iterator(source, error))
+        {
+            if (entry.is_regular_file() && entry.path().extension() == ".bin")
+            {
+                paths.push_back(entry.path().string());
+            }
+        }
+
+        std::sort(paths.begin(), paths.end());
+        return !error;
+    }
+
+    std::ifstream manifest(source);
+    if (!manifest)
+    {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        if (!line.empty() && line[0] != '#')
+        {
+            paths.push_back(line);
+        }
+    }
+
+    return true;
+}
+
+uint32_t RunBatch(const std::vector<std::string> &paths, OutputWriter &output, DecodeStats &stats, uint32_t threadCount,
+    bool execute, bool recursive, SegmentedAddress loadAddress)
+{
+    uint32_t jobCount = (uint32_t)paths.size();
+    threadCount = std::max<uint32_t>(1, std::min(threadCount, jobCount));
+
+    std::vector<BatchJob> jobs(jobCount);
+    std::vector<WorkQueue> queues(threadCount);
+    for (uint32_t i = 0; i < jobCount; i++)
+    {
+        jobs[i].path = paths[i];
+        queues[(uint64_t)i * threadCount / jobCount].jobs.push_back(i);
+    }
+
+    std::mutex doneLock;
+    std::condition_variable doneSignal;
+
+    std::vector<std::thread> workers;
+    for (uint32_t self = 0; self < threadCount; self++)
+    {
+        workers.emplace_back([&, self]() {
+            // One machine per worker, reused for every image it runs
+            std::unique_ptr<Machine> machine = std::make_unique<Machine>();
+            bool ready = InitMachine(*machine);
+
+            uint32_t job = 0;
+            while (TakeJob(queues, self, job))
+            {
+                if (ready)
+                {
+                    RunBatchJob(*machine, jobs[job], execute, recursive, loadAddress);
+                }
+
+                std::lock_guard<std::mutex> guard(doneLock);
+                jobs[job].done = true;
+                doneSignal.notify_one();
+            }
+
+            ReleaseMachine(*machine);
+        });
+    }
+
+    uint32_t failures = 0;
+    for (BatchJob &job : jobs)
+    {
+        {
+            std::unique_lock<std::mutex> guard(doneLock);
+            doneSignal.wait(guard, [&]() { return job.done.load(); });
+        }
+
+        WriteText(output, "; ");
+        WriteText(output, job.path);
+        WriteText(output, job.loaded ? "\n" : " could not be loaded\n");
+        WriteText(output, job.error);
+        WriteText(output, job.listing);
+        AccumulateStats(stats, job.stats);
+        failures += job.loaded ? 0 : 1;
+
+        std::string().swap(job.listing);
+    }
+
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+
+    FlushOutput(output);
+    return failures;
+}
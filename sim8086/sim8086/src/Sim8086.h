@@ -0,0 +1,1904 @@
+#ifndef SIM8086_H
+#define SIM8086_H
+
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#define WriteFd(fd, data, count) _write(fd, data, count)
+#define CloseFd(fd) _close(fd)
+#define OpenFdForWrite(path) _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE)
+#define STDOUT_FD 1
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define WriteFd(fd, data, count) write(fd, data, count)
+#define CloseFd(fd) close(fd)
+#define OpenFdForWrite(path) open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+#define STDOUT_FD STDOUT_FILENO
+#endif
+
+#define ArrayCount(array) sizeof(array)/sizeof(array[0])
+
+#define LO_BITS 0
+#define HI_BITS 1
+#define FULL_BITS 2
+
+#define TRUE 1
+#define FALSE 0
+
+#define SRC 0
+#define DEST 1
+
+#define MEMORY_SIZE (1024 * 1024)
+#define MEMORY_GUARD 4096   // Zeroed slack past the address space so decoding the last instruction never reads out of bounds
+#define MEMORY_MAPPING_SIZE (MEMORY_SIZE + MEMORY_GUARD)
+#define BUFFER_SIZE 1024    // Capacity of the decode ring, must be a power of two
+#define INST_LENGTH 30
+#define SEGMENT_WRAP_MARGIN 0xFF00  // Offsets past this are renormalized so no instruction's bytes wrap within a segment
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define DATA_BYTES_PER_LINE 8
+#define MAX_INSTRUCTION_LENGTH 6
+#define MIN_PARALLEL_CHUNK (16 * 1024)  // Smaller chunks spend more on thread startup than they save
+
+#define HasField(mask, field) (mask & (1 << field))
+#define ComputePhysicalAddress(at) ((at.segment * 16) + at.offset)
+#define IncrementAddress(at) at.offset++
+
+struct SegmentedAddress {
+    uint16_t segment;
+    uint16_t offset;
+};
+
+inline SegmentedAddress Create(uint16_t segment, uint16_t offset) {
+    return { 
+        .segment=segment, 
+        .offset=(uint16_t)offset 
+    };
+}
+
+enum RegisterIndex {
+    
+    Register_a,
+    Register_b,
+    Register_c,
+    Register_d,
+    Register_sp,
+    Register_bp,
+    Register_si,
+    Register_di,
+
+    Register_count
+};
+
+enum SegmentRegisters {
+    CS,
+    SS,
+    DS,
+    ES,
+
+    Segment_count
+};
+
+enum FlagsOp : uint8_t {
+    FlagsOp_none,       // `flags` is up to date
+    FlagsOp_add,
+    FlagsOp_subtract
+};
+
+/**
+ * The last arithmetic instruction's inputs and result. Most results are overwritten before anything reads the flags,
+ * so instructions only record this and the flags are worked out from it when read.
+ */
+struct LazyFlags {
+    uint32_t result;    // Unmasked, so a carry or borrow shows up above the operand width
+    uint16_t a;
+    uint16_t b;
+    FlagsOp op;
+    uint8_t wide;
+    uint8_t keepCarry;  // INC/DEC, CF in `flags` is already the one to keep
+};
+
+struct CPU {
+    uint16_t IP;
+    uint16_t registers[Register_count];
+    uint16_t segmentRegisters[Segment_count];
+    uint16_t flags;     // CpuFlags. The arithmetic ones are stale while lazyFlags.op is set, read them with MaterializeFlags.
+    LazyFlags lazyFlags;
+};
+
+/**
+ * Bits of the FLAGS register, at their 8086 positions.
+ */
+enum CpuFlags : uint16_t {
+    Flag_carry = (1 << 0),
+    Flag_parity = (1 << 2),
+    Flag_auxCarry = (1 << 4),
+    Flag_zero = (1 << 6),
+    Flag_sign = (1 << 7),
+    Flag_overflow = (1 << 11)
+};
+
+#define ARITHMETIC_FLAGS (Flag_carry | Flag_parity | Flag_auxCarry | Flag_zero | Flag_sign | Flag_overflow)
+
+struct Program {
+    uint32_t size;
+    uint32_t startAddr;
+    uint32_t endAddr;
+    SegmentedAddress loadAddress;
+    bool loaded;
+};
+
+/**
+ * Folds the offset into the segment so it is below 16, giving the same physical address with the most room left before
+ * the offset wraps.
+ */
+inline SegmentedAddress NormalizeAddress(SegmentedAddress at) {
+    return Create(at.segment + (at.offset >> 4), at.offset & 0xF);
+}
+
+enum Field : uint8_t
+{
+    Op,
+    OpExtension,
+    W_bit,
+    D_bit,
+    Reg_bit,
+    Rm_bit,
+    Mod_bit,
+    Imm_bit,
+    Addr_bit,
+    S_bit,
+    Data_bit,
+    Displacement_bit,
+
+    Field_count
+};
+
+struct RegisterAccess {
+    uint8_t index;      // index of the register in the 8086 manual. For example, register AX/AL is 000 while register CX/CL is 001
+    uint8_t offset;     // offset in the register, 0 - low bits, 1 - high bits, 2 - full 16 bits (no offset)
+};
+
+enum ModCategory: uint8_t 
+{
+    Memory_mode_no_disp,
+    Memory_mode_8_bit_disp,
+    Memory_mode_16_bit_disp,
+    Register_mode,
+
+    Mod_category_count
+};
+
+enum EffectiveAddressCalculation: uint8_t 
+{
+    Effective_addr_direct_address,
+
+    Effective_addr_bx_si,
+    Effective_addr_bx_di,
+    Effective_addr_bp_si,
+    Effective_addr_bp_di,
+    Effective_addr_si,
+    Effective_addr_di,
+    Effective_addr_bx,
+    Effective_addr_bp,
+
+    Effective_addr_count
+};
+
+struct EffectiveAddrExpression
+{
+    EffectiveAddressCalculation calculationType;
+    RegisterAccess base;
+    RegisterAccess index;
+    uint8_t hasDisplacement;
+    int16_t displacement;
+};
+
+/* Operation Definitions */
+
+enum Operation: uint8_t {
+    None,
+#define INST(mnemonic, ...) Op_##mnemonic,
+#define INST_ALT(...)
+#include "InstructionTable.inl"
+#undef INST
+#undef INST_ALT
+    Op_count
+};
+
+constexpr std::string_view Mnemonics[] = {
+    "none",
+#define INST(mnemonic, ...) #mnemonic,
+#define INST_ALT(...)
+#include "InstructionTable.inl"
+#undef INST
+#undef INST_ALT
+};
+
+/**
+ * Represents the bit patterns/fields in an Intel 8086 instruction
+ */
+struct Bits 
+{
+    Field field;
+    uint8_t value;
+    uint8_t mask;
+    uint8_t shift;
+    uint8_t count;
+};
+
+enum Flags {
+    Wide = (1 << 0),
+    IPInc = (1 << 1),
+    CSInc = (1 << 2),     // Intersegment, loads CS as well as IP
+    RmIsWide = (1 << 3)
+};
+
+struct Entry {
+    Operation mnemonic;
+    Bits bits[Field::Field_count];
+    uint16_t flags;
+};
+
+constexpr Entry InstructionTable[] = {
+#include "InstructionTable.inl"
+};
+
+/* Opcode Dispatch */
+
+#define MAX_OPCODE_CANDIDATES 8
+
+#define NO_EXTENSION 0xFF
+
+#define NO_ENTRY 0xFF
+
+static_assert(ArrayCount(InstructionTable) < NO_ENTRY, "Instruction table entries must be indexable with a uint8_t");
+
+/**
+ * Table entries whose opcode bits match a single first byte. Entries are indices into InstructionTable and are kept in
+ * table order, so the decoder tries them in the same order the old linear scan did.
+ */
+struct OpcodeCandidates {
+    uint8_t count;
+    uint8_t entries[MAX_OPCODE_CANDIDATES];
+    uint8_t usesExtension;      // Entry is selected by the reg field of the ModRM byte (group opcodes)
+    uint8_t extensions[8];      // Entry index for each ModRM reg value, NO_ENTRY when no entry uses that extension
+};
+
+struct OpcodeDispatch {
+    OpcodeCandidates candidates[256];
+    bool overflow;      // A byte matched more than MAX_OPCODE_CANDIDATES entries
+    bool ambiguous;     // Two entries matched the same byte and their OpExtension bits cannot tell them apart
+};
+
+constexpr uint8_t EntryExtension(const Entry &entry)
+{
+    for (const Bits &bits : entry.bits)
+    {
+        if (bits.field == OpExtension && bits.count != 0)
+        {
+            return bits.value;
+        }
+    }
+
+    return NO_EXTENSION;
+}
+
+constexpr bool EntryMatchesByte(const Entry &entry, uint8_t byte)
+{
+    return entry.bits[0].value == (byte >> (8 - entry.bits[0].count));
+}
+
+/**
+ * Expands InstructionTable into a first byte lookup table at compile time. Two entries sharing a first byte are only
+ * allowed when both carry an OpExtension and the extensions differ, otherwise the encoding is ambiguous.
+ */
+constexpr OpcodeDispatch BuildOpcodeDispatch()
+{
+    OpcodeDispatch dispatch = {};
+
+    for (int byte = 0; byte < 256; byte++)
+    {
+        OpcodeCandidates &candidates = dispatch.candidates[byte];
+
+        for (uint8_t i = 0; i < ArrayCount(InstructionTable); i++)
+        {
+            const Entry &entry = InstructionTable[i];
+            if (!EntryMatchesByte(entry, (uint8_t)byte))
+            {
+                continue;
+            }
+
+            if (candidates.count == MAX_OPCODE_CANDIDATES)
+            {
+                dispatch.overflow = true;
+                break;
+            }
+
+            uint8_t extension = EntryExtension(entry);
+            for (int j = 0; j < candidates.count; j++)
+            {
+                uint8_t other = EntryExtension(InstructionTable[candidates.entries[j]]);
+                if (extension == NO_EXTENSION || other == NO_EXTENSION || extension == other)
+                {
+                    dispatch.ambiguous = true;
+                }
+            }
+
+            candidates.entries[candidates.count] = i;
+            candidates.count++;
+        }
+
+        // Group opcodes get a second level keyed on the OpExtension bits in the ModRM reg field
+        for (uint8_t &extension : candidates.extensions)
+        {
+            extension = NO_ENTRY;
+        }
+
+        for (int j = 0; j < candidates.count; j++)
+        {
+            uint8_t extension = EntryExtension(InstructionTable[candidates.entries[j]]);
+            if (extension != NO_EXTENSION)
+            {
+                candidates.usesExtension = TRUE;
+                candidates.extensions[extension] = candidates.entries[j];
+            }
+        }
+    }
+
+    return dispatch;
+}
+
+constexpr OpcodeDispatch OpcodeTable = BuildOpcodeDispatch();
+
+static_assert(!OpcodeTable.overflow, "An opcode byte matches more than MAX_OPCODE_CANDIDATES instruction table entries");
+
+static_assert(!OpcodeTable.ambiguous, "Two instruction table entries share an opcode byte without distinct OpExtension bits");
+
+/**
+ * Decoder counters. `speculativeDecodesAvoided` counts the candidate entries that walking the candidate list would have
+ * decoded and thrown away before reaching the entry selected by the ModRM dispatch.
+ */
+struct DecodeStats {
+    uint64_t instructions;
+    uint64_t decodeAttempts;
+    uint64_t rejectedDecodes;
+    uint64_t speculativeDecodesAvoided;
+};
+
+void AccumulateStats(DecodeStats &into, const DecodeStats &stats);
+
+void PrintDecodeStats(const DecodeStats &stats);
+
+constexpr std::string_view RegisterNames[Register_count][3] = {
+    {"AL", "AH", "AX"},
+    {"BL", "BH", "BX"},
+    {"CL", "CH", "CX"},
+    {"DL", "DH", "DX"},
+    {"", "", "SP"},
+    {"", "", "BP"},
+    {"", "", "SI"},
+    {"", "", "DI"}
+};
+
+/**
+ * Register selected by a 3-bit reg/rm field, indexed by [w][reg].
+ */
+constexpr RegisterAccess RegisterTable[2][8] = {
+    {
+        { Register_a, LO_BITS }, { Register_c, LO_BITS }, { Register_d, LO_BITS }, { Register_b, LO_BITS },
+        { Register_a, HI_BITS }, { Register_c, HI_BITS }, { Register_d, HI_BITS }, { Register_b, HI_BITS }
+    },
+    {
+        { Register_a, FULL_BITS }, { Register_c, FULL_BITS }, { Register_d, FULL_BITS }, { Register_b, FULL_BITS },
+        { Register_sp, FULL_BITS }, { Register_bp, FULL_BITS }, { Register_si, FULL_BITS }, { Register_di, FULL_BITS }
+    }
+};
+
+inline void DecodeRegister(uint8_t reg, uint8_t w, RegisterAccess &regAccess)
+{
+    regAccess = RegisterTable[w][reg];
+}
+
+enum OperandType {
+    OpType_none, 
+
+    OpType_register,
+    OpType_effectiveAddrCalc,
+    OpType_immediate,
+    OpType_jmp,
+
+    OpType_count
+};
+
+struct Jump {
+    uint16_t ipAddress;
+    uint16_t csAddress;
+};
+
+struct Operand {
+    OperandType type;
+    union {
+        RegisterAccess reg;
+        EffectiveAddrExpression expression;
+        int16_t immediate;
+        uint32_t address;
+        Jump jmp;
+    };
+};
+
+struct Instruction {
+    Operation op;
+    uint32_t address;
+    uint16_t size;
+    uint16_t flags;
+    Operand operands[2];
+};
+
+/* ModRM Decoding */
+
+/**
+ * Everything a ModRM byte says about its operands for a given W. The r/m operand is either `rm` (register mode) or an
+ * effective address with `displacementSize` bytes of displacement following the ModRM byte. `reg` is the register
+ * selected by the reg field.
+ */
+struct ModRmDescriptor {
+    uint8_t type;                                   // OpType_register or OpType_effectiveAddrCalc
+    EffectiveAddressCalculation calculationType;
+    RegisterAccess base;
+    RegisterAccess index;
+    uint8_t hasDisplacement;
+    uint8_t displacementSize;
+    RegisterAccess rm;
+    RegisterAccess reg;
+};
+
+struct ModRmDescriptors {
+    ModRmDescriptor descriptors[2][256];
+};
+
+constexpr ModRmDescriptors BuildModRmTable()
+{
+    // Effective address form for each r/m value when mod is not register mode
+    constexpr struct {
+        EffectiveAddressCalculation calculationType;
+        RegisterAccess base;
+        RegisterAccess index;
+    } EffectiveAddressForms[8] = {
+        { Effective_addr_bx_si, { Register_b, FULL_BITS }, { Register_si, FULL_BITS } },
+        { Effective_addr_bx_di, { Register_b, FULL_BITS }, { Register_di, FULL_BITS } },
+        { Effective_addr_bp_si, { Register_bp, FULL_BITS }, { Register_si, FULL_BITS } },
+        { Effective_addr_bp_di, { Register_bp, FULL_BITS }, { Register_di, FULL_BITS } },
+        { Effective_addr_si, { Register_si, FULL_BITS }, {} },
+        { Effective_addr_di, { Register_di, FULL_BITS }, {} },
+        { Effective_addr_bp, { Register_bp, FULL_BITS }, {} },
+        { Effective_addr_bx, { Register_b, FULL_BITS }, {} },
+    };
+
+    ModRmDescriptors table = {};
+
+    for (int w = 0; w < 2; w++)
+    {
+        for (int modrm = 0; modrm < 256; modrm++)
+        {
+            uint8_t mod = modrm >> 6;
+            uint8_t rm = modrm & 0b111;
+            ModRmDescriptor &descriptor = table.descriptors[w][modrm];
+            descriptor.reg = RegisterTable[w][(modrm >> 3) & 0b111];
+
+            if (mod == Register_mode)
+            {
+                descriptor.type = OpType_register;
+                descriptor.rm = RegisterTable[w][rm];
+                continue;
+            }
+
+            descriptor.type = OpType_effectiveAddrCalc;
+
+            if (mod == Memory_mode_no_disp && rm == 0b110)
+            {
+                descriptor.calculationType = Effective_addr_direct_address;
+                descriptor.displacementSize = 2;
+                continue;
+            }
+
+            descriptor.calculationType = EffectiveAddressForms[rm].calculationType;
+            descriptor.base = EffectiveAddressForms[rm].base;
+            descriptor.index = EffectiveAddressForms[rm].index;
+            descriptor.hasDisplacement = (mod != Memory_mode_no_disp);
+            descriptor.displacementSize = mod;
+        }
+    }
+
+    return table;
+}
+
+constexpr ModRmDescriptors ModRmTable = BuildModRmTable();
+
+bool OperandsEqual(const Operand &a, const Operand &b);
+
+bool InstructionsEqual(const Instruction &a, const Instruction &b);
+
+/* Packed Instructions */
+
+/**
+ * 16 byte form of an Instruction for anything that keeps many of them around. Each operand is one descriptor byte,
+ * the OperandType in the top 3 bits over a 5 bit payload, plus a 16 bit value. Registers pack their index and offset
+ * into the payload, effective addresses their calculation type and displacement bit. The base/index registers are
+ * implied by the calculation type. Jumps keep their raw displacement, and the size is added back when unpacking.
+ */
+struct PackedInstruction {
+    uint32_t address;
+    uint16_t flags;
+    Operation op;
+    uint8_t size;
+    uint8_t operands[2];    // Descriptor bytes, indexed by SRC/DEST
+    int16_t values[2];      // Immediate, displacement or jump displacement, indexed by SRC/DEST
+};
+
+static_assert(sizeof(PackedInstruction) == 16, "PackedInstruction should stay four to a cache line");
+static_assert(OpType_count <= 8, "Operand types must fit in the 3 bit descriptor field");
+static_assert(Effective_addr_count <= 16, "Effective address calculations must fit in the 4 bit descriptor field");
+
+#define PACKED_TYPE_SHIFT 5
+#define PACKED_PAYLOAD_MASK 0b11111
+#define PACKED_REGISTER_OFFSET_SHIFT 3
+#define PACKED_HAS_DISPLACEMENT (1 << 4)
+
+/** Base and index registers of each effective address calculation, indexed by EffectiveAddressCalculation. */
+constexpr RegisterAccess EffectiveAddressRegisters[Effective_addr_count][2] = {
+    { {}, {} },
+    { { Register_b, FULL_BITS }, { Register_si, FULL_BITS } },
+    { { Register_b, FULL_BITS }, { Register_di, FULL_BITS } },
+    { { Register_bp, FULL_BITS }, { Register_si, FULL_BITS } },
+    { { Register_bp, FULL_BITS }, { Register_di, FULL_BITS } },
+    { { Register_si, FULL_BITS }, {} },
+    { { Register_di, FULL_BITS }, {} },
+    { { Register_b, FULL_BITS }, {} },
+    { { Register_bp, FULL_BITS }, {} },
+};
+
+inline void PackOperand(const Operand &op, uint8_t size, uint8_t &descriptor, int16_t &value)
+{
+    uint8_t payload = 0;
+    value = 0;
+
+    switch (op.type)
+    {
+        case OpType_register:
+            {
+                payload = op.reg.index | (op.reg.offset << PACKED_REGISTER_OFFSET_SHIFT);
+            } break;
+        case OpType_effectiveAddrCalc:
+            {
+                payload = op.expression.calculationType | (op.expression.hasDisplacement ? PACKED_HAS_DISPLACEMENT : 0);
+                value = op.expression.displacement;
+            } break;
+        case OpType_immediate:
+            {
+                value = op.immediate;
+            } break;
+        case OpType_jmp:
+            {
+                value = (int16_t)(op.address - size);
+            } break;
+        default:
+            {
+            }
+    }
+
+    descriptor = (uint8_t)((op.type << PACKED_TYPE_SHIFT) | payload);
+}
+
+inline Operand UnpackOperand(uint8_t descriptor, int16_t value, uint8_t size)
+{
+    Operand op = {};
+    op.type = (OperandType)(descriptor >> PACKED_TYPE_SHIFT);
+    uint8_t payload = descriptor & PACKED_PAYLOAD_MASK;
+
+    switch (op.type)
+    {
+        case OpType_register:
+            {
+                op.reg = { (uint8_t)(payload & 0b111), (uint8_t)(payload >> PACKED_REGISTER_OFFSET_SHIFT) };
+            } break;
+        case OpType_effectiveAddrCalc:
+            {
+                EffectiveAddressCalculation calculationType = (EffectiveAddressCalculation)(payload & 0b1111);
+                op.expression = {
+                    .calculationType = calculationType,
+                    .base = EffectiveAddressRegisters[calculationType][0],
+                    .index = EffectiveAddressRegisters[calculationType][1],
+                    .hasDisplacement = (uint8_t)((payload & PACKED_HAS_DISPLACEMENT) != 0),
+                    .displacement = value
+                };
+            } break;
+        case OpType_immediate:
+            {
+                op.immediate = value;
+            } break;
+        case OpType_jmp:
+            {
+                op.address = (uint32_t)value + size;
+            } break;
+        default:
+            {
+            }
+    }
+
+    return op;
+}
+
+inline PackedInstruction PackInstruction(const Instruction &inst)
+{
+    PackedInstruction packed = {
+        .address = inst.address,
+        .flags = inst.flags,
+        .op = inst.op,
+        .size = (uint8_t)inst.size
+    };
+
+    PackOperand(inst.operands[SRC], packed.size, packed.operands[SRC], packed.values[SRC]);
+    PackOperand(inst.operands[DEST], packed.size, packed.operands[DEST], packed.values[DEST]);
+    return packed;
+}
+
+inline Instruction UnpackInstruction(const PackedInstruction &packed)
+{
+    Instruction inst = {
+        .op = packed.op,
+        .address = packed.address,
+        .size = packed.size,
+        .flags = packed.flags
+    };
+
+    inst.operands[SRC] = UnpackOperand(packed.operands[SRC], packed.values[SRC], packed.size);
+    inst.operands[DEST] = UnpackOperand(packed.operands[DEST], packed.values[DEST], packed.size);
+    return inst;
+}
+
+static_assert((BUFFER_SIZE & (BUFFER_SIZE - 1)) == 0, "BUFFER_SIZE must be a power of two");
+
+/**
+ * Bounded queue between the decoder and the formatter. `head` and `tail` only ever grow and are masked down to a slot,
+ * so memory use stays the same no matter how large the program is. The decoder drains the ring whenever it fills up.
+ * Entries are stored packed, which keeps the whole ring in 16 KiB.
+ */
+struct InstructionRing {
+    PackedInstruction entries[BUFFER_SIZE];
+    uint32_t head;      // Next slot the decoder writes
+    uint32_t tail;      // Next slot the formatter reads
+};
+
+inline bool RingIsFull(const InstructionRing &ring)
+{
+    return ring.head - ring.tail == BUFFER_SIZE;
+}
+
+inline void RingPush(InstructionRing &ring, const Instruction &inst)
+{
+    ring.entries[ring.head & (BUFFER_SIZE - 1)] = PackInstruction(inst);
+    ring.head++;
+}
+
+inline bool RingPop(InstructionRing &ring, Instruction &inst)
+{
+    if (ring.tail == ring.head)
+    {
+        return false;
+    }
+
+    inst = UnpackInstruction(ring.entries[ring.tail & (BUFFER_SIZE - 1)]);
+    ring.tail++;
+    return true;
+}
+
+/* Block Cache */
+
+#define BLOCK_CACHE_BUDGET (1024 * 1024)    // Bytes for the block table and the instruction pool together
+#define BLOCK_CACHE_SLOTS 4096              // Must be a power of two
+#define BLOCK_MAX_INSTRUCTIONS 32
+#define BLOCK_MAX_BYTES (BLOCK_MAX_INSTRUCTIONS * MAX_INSTRUCTION_LENGTH)
+#define NO_BLOCK 0xFFFFFFFF
+#define CODE_PAGE_SHIFT 8                   // 256-byte pages for self-modifying code detection
+#define CODE_PAGE_COUNT (MEMORY_SIZE >> CODE_PAGE_SHIFT)
+#define RETURN_STACK_SIZE 16                // Must be a power of two
+
+static_assert((BLOCK_CACHE_SLOTS & (BLOCK_CACHE_SLOTS - 1)) == 0, "BLOCK_CACHE_SLOTS must be a power of two");
+static_assert(CODE_PAGE_COUNT % 64 == 0, "The code page bitmap is stored in 64-bit words");
+static_assert((RETURN_STACK_SIZE & (RETURN_STACK_SIZE - 1)) == 0, "RETURN_STACK_SIZE must be a power of two");
+
+/**
+ * Straight-line guest code decoded once for re-execution. A block ends after its first JMP, Jcc, LOOP*, JCXZ or RET,
+ * after BLOCK_MAX_INSTRUCTIONS, or where the next bytes don't decode.
+ */
+struct CachedBlock {
+    uint32_t address;   // Physical address of the first instruction, NO_BLOCK for an empty slot
+    uint32_t first;     // Index of the first instruction in BlockCache::instructions
+    uint16_t count;
+    uint16_t size;      // Bytes of guest code covered
+    uint32_t links[2];  // Slots of the blocks last seen after this one: [0] the jump target, [1] the fall-through
+};
+
+struct BlockCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;     // Blocks dropped, either displaced from their slot or by a flush
+    uint64_t flushes;       // Times the instruction pool ran out and every block was dropped
+    uint64_t translated;    // Instructions decoded into blocks
+    uint64_t invalidations; // Blocks dropped because the guest wrote into their code
+    uint64_t chained;       // Blocks entered through a link from the previous block, without a table lookup
+    uint64_t returnHits;    // RETs that entered the block slot the return stack predicted
+    uint64_t returnMisses;  // RETs that didn't, including those with nothing on the return stack
+};
+
+/**
+ * A word pushed on the guest stack that a RET may later pop. The instruction table has no CALL, so code returns to
+ * addresses it PUSHed itself and every pushed word is a candidate. The block slot for CS:word is worked out at the
+ * push, so the RET only has to check that the slot holds the block it popped.
+ */
+struct ReturnEntry {
+    uint16_t sp;        // SP just after the push
+    uint32_t slot;
+};
+
+/**
+ * Shadow of the last RETURN_STACK_SIZE words on the guest stack. Older entries are overwritten when it wraps.
+ */
+struct ReturnStack {
+    ReturnEntry entries[RETURN_STACK_SIZE];
+    uint32_t top;
+    uint32_t depth;
+};
+
+/**
+ * Where the next instruction comes from when running out of the block cache: the rest of the current block.
+ */
+struct BlockCursor {
+    const Instruction *next;
+    const Instruction *end;
+};
+
+/**
+ * Blocks keyed by the physical address of CS:IP in a direct-mapped table, with their decoded instructions in a pool
+ * that is bump allocated. A block displaced from its slot leaves its instructions behind until the pool runs out, and
+ * then the whole cache is flushed, so the cache never grows past the budget it was created with.
+ *
+ * `codePages` has a bit set for every page that some live block's code overlaps, so a guest write only has to look for
+ * stale blocks when it lands on one of those pages.
+ *
+ * A block that ends in a direct jump, or falls through, remembers the blocks that followed it, so a loop goes from block
+ * to block without a table lookup. Links and return predictions are only taken when the linked slot still holds a
+ * block at CS:IP, so nothing needs to unlink them when a block is dropped.
+ */
+struct BlockCache {
+    std::vector<CachedBlock> slots;
+    std::vector<Instruction> instructions;
+    uint32_t used;      // Pool entries handed out since the last flush
+    uint32_t live;      // Occupied slots
+    BlockCursor current;
+    uint32_t previous;      // Slot of the block `current` runs through, NO_BLOCK before the first
+    uint32_t predicted;     // Slot the last RET is predicted to land in, NO_BLOCK when there's no prediction
+    ReturnStack returns;
+    bool active;            // Run is executing from the cache. PUSH, POP and RET leave the return stack alone otherwise.
+    uint64_t codePages[CODE_PAGE_COUNT / 64];
+    uint16_t pageBlocks[CODE_PAGE_COUNT];   // Live blocks overlapping each page
+    BlockCacheStats stats;
+};
+
+/**
+ * Sizes the cache to `budget` bytes. The table always takes BLOCK_CACHE_SLOTS entries and the pool gets the rest, but
+ * never less than one block's worth.
+ */
+void InitBlockCache(BlockCache &cache, size_t budget);
+
+/**
+ * Drops every block. Needed whenever guest code changes under the cache, such as loading a new image.
+ */
+void FlushBlockCache(BlockCache &cache);
+
+inline uint32_t BlockSlot(uint32_t address)
+{
+    return (address * 2654435761u) >> (32 - std::countr_zero((uint32_t)BLOCK_CACHE_SLOTS));
+}
+
+inline bool IsCodePage(const BlockCache &cache, uint32_t address)
+{
+    uint32_t page = address >> CODE_PAGE_SHIFT;
+    return (cache.codePages[page >> 6] >> (page & 63)) & 1;
+}
+
+/**
+ * Drops every block whose code covers `address` and ends the block being executed, so the next instruction is decoded
+ * again from memory.
+ */
+void InvalidateCode(BlockCache &cache, uint32_t address);
+
+/* Machine */
+
+/**
+ * Everything one simulation owns: its address space, CPU registers, the decode ring and the decoder counters. Machines
+ * share nothing, so independent ones can run on separate threads.
+ */
+struct Machine {
+    uint8_t *memory;    // MEMORY_MAPPING_SIZE bytes: the 1 MiB address space plus a zeroed guard
+    CPU cpu;
+    InstructionRing decoded;
+    DecodeStats stats;
+    BlockCache blocks;  // Allocated by the first Run that uses it
+};
+
+/**
+ * Reserves a zeroed address space for a machine. Returns false if it can't be allocated.
+ */
+bool InitMachine(Machine &machine);
+
+void ReleaseMachine(Machine &machine);
+
+inline uint8_t ReadByteFromMemory(const Machine &machine, SegmentedAddress at) {
+    uint32_t address = ComputePhysicalAddress(at);
+    return machine.memory[address];
+}
+
+inline uint16_t ReadWordFromMemory(const Machine &machine, SegmentedAddress at) {
+    uint32_t address = ComputePhysicalAddress(at);
+    uint8_t lo = machine.memory[address];
+    uint16_t hi = machine.memory[address+1];
+    return ((hi << 8) | lo);
+}
+
+/**
+ * Stores a byte at a physical address inside the 1 MiB space. Writes to pages holding cached code invalidate the blocks
+ * they hit; any other write costs one bit test.
+ */
+inline void WriteByteToMemory(Machine &machine, uint32_t address, uint8_t value) {
+    machine.memory[address] = value;
+    if (IsCodePage(machine.blocks, address))
+    {
+        InvalidateCode(machine.blocks, address);
+    }
+}
+
+inline uint8_t FetchNextInstructionByte(Machine &machine) {
+    CPU &cpu = machine.cpu;
+    SegmentedAddress at = { .segment=cpu.segmentRegisters[CS], .offset=cpu.IP};
+    uint32_t address = ComputePhysicalAddress(at);
+    cpu.IP++;
+    return machine.memory[address];
+}
+
+/* Output */
+
+/**
+ * Listing text is rendered into `buffer` and handed to the OS with a few large write() calls instead of several printf
+ * calls per instruction.
+ */
+struct OutputWriter {
+    char buffer[OUTPUT_BUFFER_SIZE];
+    size_t used;
+    int fd;
+    std::string *capture;   // When set, flushed text is appended here instead of written to fd
+};
+
+void OpenOutput(OutputWriter &writer, int fd);
+
+void OpenCapture(OutputWriter &writer, std::string *capture);
+
+/**
+ * Hands text straight to the writer's destination, bypassing the buffer.
+ */
+void WriteThrough(OutputWriter &writer, const char *data, size_t size);
+
+void FlushOutput(OutputWriter &writer);
+
+inline void ReserveOutput(OutputWriter &writer, size_t count)
+{
+    if (writer.used + count > OUTPUT_BUFFER_SIZE)
+    {
+        FlushOutput(writer);
+    }
+}
+
+inline void WriteText(OutputWriter &writer, std::string_view text)
+{
+    ReserveOutput(writer, text.size());
+    if (text.size() > OUTPUT_BUFFER_SIZE)
+    {
+        WriteThrough(writer, text.data(), text.size());
+        return;
+    }
+
+    memcpy(writer.buffer + writer.used, text.data(), text.size());
+    writer.used += text.size();
+}
+
+inline void WriteNumber(OutputWriter &writer, int32_t value)
+{
+    ReserveOutput(writer, 16);
+    char *end = std::to_chars(writer.buffer + writer.used, writer.buffer + OUTPUT_BUFFER_SIZE, value).ptr;
+    writer.used = end - writer.buffer;
+}
+
+inline void WriteCount(OutputWriter &writer, uint64_t value)
+{
+    ReserveOutput(writer, 24);
+    char *end = std::to_chars(writer.buffer + writer.used, writer.buffer + OUTPUT_BUFFER_SIZE, value).ptr;
+    writer.used = end - writer.buffer;
+}
+
+/**
+ * Opens (or truncates) an assembly file for the listing and writes the NASM header. Returns false if the file could not
+ * be created.
+ */
+bool OpenAsmFile(OutputWriter &writer, const std::string &name);
+
+void CloseAsmFile(OutputWriter &writer);
+
+void WriteEffectiveAddressExpression(OutputWriter &writer, const EffectiveAddrExpression &expression);
+
+void WriteOperand(OutputWriter &writer, const Operand &op);
+
+/* Control Flow */
+
+enum ControlFlow {
+    Flow_next,      // Falls through to the following instruction
+    Flow_branch,    // Either falls through or jumps to its target
+    Flow_jump,      // Always jumps to its target
+    Flow_stop,      // Leaves to somewhere the bytes don't tell us (RET, indirect JMP)
+};
+
+ControlFlow ClassifyControlFlow(const Instruction &inst);
+
+/**
+ * Physical address a relative jump running in `segment` lands on. The jump operand holds its target relative to the
+ * instruction start, and the new IP wraps within the segment like the 8086's 16-bit IP does.
+ */
+inline uint32_t JumpTarget(const Instruction &inst, uint16_t segment)
+{
+    uint32_t base = (uint32_t)segment << 4;
+    uint16_t ip = (uint16_t)(inst.address - base + inst.operands[DEST].address);
+    return base + ip;
+}
+
+/**
+ * Label number (1-based) for a physical address in a sorted target list, or 0 if it has none.
+ */
+uint32_t FindLabel(const std::vector<uint32_t> &labels, uint32_t address);
+
+void WriteHexByte(OutputWriter &writer, uint8_t value);
+
+/**
+ * Formats one instruction. With a nonzero `label`, a relative jump prints its target as `L<label>` instead of `$+d`.
+ */
+void WriteInstruction(OutputWriter &writer, const Instruction &inst, uint32_t label = 0);
+
+/**
+ * Formats and drains every instruction currently queued in the decode ring.
+ */
+void WriteInstructions(InstructionRing &ring, OutputWriter &writer);
+
+/* Decoding */
+
+/**
+ * Fills in the r/m operand described by a ModRM descriptor, reading the displacement that follows the ModRM byte.
+ */
+inline void InterpretModRm(const Machine &machine, const ModRmDescriptor &descriptor, Operand &operand, SegmentedAddress &at)
+{
+    if (descriptor.type == OpType_register)
+    {
+        operand.type = OpType_register;
+        operand.reg = descriptor.rm;
+        return;
+    }
+
+    EffectiveAddrExpression exp = {
+        .calculationType = descriptor.calculationType,
+        .base = descriptor.base,
+        .index = descriptor.index,
+        .hasDisplacement = descriptor.hasDisplacement
+    };
+
+    if (descriptor.displacementSize == 1)
+    {
+        exp.displacement = (int16_t)(int8_t)ReadByteFromMemory(machine, at);
+        IncrementAddress(at);
+    }
+    else if (descriptor.displacementSize == 2)
+    {
+        exp.displacement = (int16_t)ReadWordFromMemory(machine, at);
+        IncrementAddress(at);
+        IncrementAddress(at);
+    }
+
+    operand.type = OpType_effectiveAddrCalc;
+    operand.expression = exp;
+}
+
+/**
+* NOTE: Extracted from Decode to make Decode slightly easier to read. Provides no other function than that. 
+*/
+uint8_t ParseDataFromByte(const Machine &machine, Bits current, uint8_t &usedBits, SegmentedAddress &cursor);
+
+/**
+ * Selects the InstructionTable entry for the instruction starting at `at` without decoding any operands. Group opcodes
+ * (0x80-0x83, 0xFE/0xFF, ...) are resolved on the reg field of the ModRM byte. Returns NO_ENTRY when nothing matches.
+ */
+inline uint8_t LookupEntry(Machine &machine, SegmentedAddress at)
+{
+    const OpcodeCandidates &candidates = OpcodeTable.candidates[ReadByteFromMemory(machine, at)];
+    if (!candidates.usesExtension)
+    {
+        return (candidates.count == 0) ? NO_ENTRY : candidates.entries[0];
+    }
+
+    IncrementAddress(at);
+    uint8_t entry = candidates.extensions[(ReadByteFromMemory(machine, at) >> 3) & 0b111];
+
+    uint8_t skipped = 0;
+    while (skipped < candidates.count && candidates.entries[skipped] != entry)
+    {
+        skipped++;
+    }
+    machine.stats.speculativeDecodesAvoided += skipped;
+
+    return entry;
+}
+
+Instruction Decode(Machine &machine, Entry entry, SegmentedAddress &at);
+
+/* Specialized Decoders */
+
+/**
+ * Where a single field of a table entry lives. Fields with a count of 0 are constants, everything else is read from
+ * `byte` bytes past the start of the instruction with a fixed shift and mask.
+ */
+struct FieldLayout {
+    uint8_t present;
+    uint8_t isConstant;
+    uint8_t value;      // Constant value, or the required bits for OpExtension
+    uint8_t byte;
+    uint8_t shift;
+    uint8_t mask;
+};
+
+struct EntryLayout {
+    FieldLayout fields[Field_count];
+    uint8_t opcodeBytes;    // Bytes covered by the bit fields. Displacement and data bytes follow these.
+};
+
+/**
+ * Runs the same byte walk Decode() does over an entry's Bits, but at compile time.
+ */
+constexpr EntryLayout ComputeEntryLayout(const Entry &entry)
+{
+    EntryLayout layout = {};
+    uint8_t byte = 0;
+    uint8_t usedBits = 0;
+
+    for (int i = 0; i < Field_count && !(entry.bits[i].field == Op && entry.bits[i].count == 0); i++)
+    {
+        const Bits &bits = entry.bits[i];
+        FieldLayout &field = layout.fields[bits.field];
+        field.present = TRUE;
+        field.value = bits.value;
+
+        if (bits.count == 0)
+        {
+            field.isConstant = TRUE;
+        }
+        else
+        {
+            if (usedBits >= 8)
+            {
+                byte++;
+                usedBits = 0;
+            }
+
+            field.byte = byte;
+            field.shift = bits.shift;
+            field.mask = bits.mask;
+        }
+
+        usedBits += bits.count;
+    }
+
+    layout.opcodeBytes = byte + 1;
+    return layout;
+}
+
+constexpr std::array<EntryLayout, ArrayCount(InstructionTable)> BuildEntryLayouts()
+{
+    std::array<EntryLayout, ArrayCount(InstructionTable)> layouts = {};
+    for (size_t i = 0; i < layouts.size(); i++)
+    {
+        layouts[i] = ComputeEntryLayout(InstructionTable[i]);
+    }
+    return layouts;
+}
+
+constexpr std::array<EntryLayout, ArrayCount(InstructionTable)> EntryLayouts = BuildEntryLayouts();
+
+template <uint8_t EntryIndex, Field F>
+inline uint8_t ReadField(const Machine &machine, SegmentedAddress start)
+{
+    constexpr FieldLayout field = EntryLayouts[EntryIndex].fields[F];
+
+    if constexpr (!field.present)
+    {
+        return 0;
+    }
+    else if constexpr (field.isConstant)
+    {
+        return field.value;
+    }
+    else
+    {
+        start.offset += field.byte;
+        return (ReadByteFromMemory(machine, start) >> field.shift) & field.mask;
+    }
+}
+
+/**
+ * Decode() specialized on one InstructionTable entry. Field positions, operand direction and which operand kinds exist
+ * are all known at compile time, so only the loads and the ModRM interpretation are left at runtime.
+ */
+template <uint8_t EntryIndex>
+Instruction DecodeSpecialized(Machine &machine, SegmentedAddress &at)
+{
+    constexpr Entry entry = InstructionTable[EntryIndex];
+    constexpr EntryLayout layout = EntryLayouts[EntryIndex];
+
+    machine.stats.decodeAttempts++;
+
+    Instruction inst = {};
+    inst.address = ComputePhysicalAddress(at);
+
+    if constexpr (layout.fields[OpExtension].present)
+    {
+        if (ReadField<EntryIndex, OpExtension>(machine, at) != layout.fields[OpExtension].value)
+        {
+            machine.stats.rejectedDecodes++;
+            return inst;
+        }
+    }
+
+    uint8_t d = ReadField<EntryIndex, D_bit>(machine, at);
+    uint8_t w = ReadField<EntryIndex, W_bit>(machine, at);
+    uint8_t s = ReadField<EntryIndex, S_bit>(machine, at);
+    SegmentedAddress start = at;
+    at.offset += layout.opcodeBytes;
+
+    inst.op = entry.mnemonic;
+    inst.flags |= w | (entry.flags & CSInc);
+
+    constexpr FieldLayout mod = layout.fields[Mod_bit];
+    constexpr FieldLayout rm = layout.fields[Rm_bit];
+    constexpr FieldLayout reg = layout.fields[Reg_bit];
+
+    // A real ModRM byte holds mod, reg and rm at their usual positions, so the raw byte indexes ModRmTable directly
+    constexpr bool hasModRmByte = mod.present && !mod.isConstant && mod.shift == 6 && rm.byte == mod.byte && rm.shift == 0;
+    constexpr bool regInModRmByte = hasModRmByte && !reg.isConstant && reg.byte == mod.byte && reg.shift == 3 &&
+        !(entry.flags & RmIsWide);
+
+    if constexpr (mod.present)
+    {
+        uint8_t isWide = (entry.flags & RmIsWide) ? 1 : w;
+        uint8_t modrm = 0;
+        if constexpr (hasModRmByte)
+        {
+            SegmentedAddress modrmAt = start;
+            modrmAt.offset += mod.byte;
+            modrm = ReadByteFromMemory(machine, modrmAt);
+        }
+        else
+        {
+            modrm = (ReadField<EntryIndex, Mod_bit>(machine, start) << 6) | ReadField<EntryIndex, Rm_bit>(machine, start);
+        }
+
+        const ModRmDescriptor &descriptor = ModRmTable.descriptors[isWide][modrm];
+
+        Operand op = {};
+        InterpretModRm(machine, descriptor, op, at);
+        inst.operands[!d] = op;
+
+        if constexpr (regInModRmByte)
+        {
+            inst.operands[d] = {
+                .type = OpType_register,
+                .reg = descriptor.reg
+            };
+        }
+    }
+
+    if constexpr (reg.present && !regInModRmByte)
+    {
+        RegisterAccess a = {};
+        DecodeRegister(ReadField<EntryIndex, Reg_bit>(machine, start), w, a);
+        inst.operands[d] = {
+            .type = OpType_register,
+            .reg = a
+        };
+    }
+
+    if constexpr (layout.fields[Imm_bit].present)
+    {
+        Operand op = {};
+        op.type = OpType_immediate;
+
+        bool isByte = (w == 1 && s == 1) || (w == 0);
+        if (isByte)
+        {
+            op.immediate = (int16_t)(int8_t)ReadByteFromMemory(machine, at);
+            IncrementAddress(at);
+        }
+        else
+        {
+            op.immediate = (int16_t)ReadWordFromMemory(machine, at);
+            IncrementAddress(at);
+            IncrementAddress(at);
+        }
+
+        inst.operands[SRC] = op;
+    }
+
+    if constexpr (layout.fields[Addr_bit].present)
+    {
+        EffectiveAddrExpression ex = {
+            .calculationType = Effective_addr_direct_address,
+            .displacement = (int16_t)ReadWordFromMemory(machine, at)
+        };
+
+        IncrementAddress(at);
+        IncrementAddress(at);
+
+        inst.operands[!d] = {
+            .type = OpType_effectiveAddrCalc,
+            .expression = ex
+        };
+    }
+
+    if constexpr (layout.fields[Displacement_bit].present)
+    {
+        int16_t displacement = 0;
+        if (w == 1)
+        {
+            displacement = (int16_t)ReadWordFromMemory(machine, at);
+            IncrementAddress(at);
+            IncrementAddress(at);
+        }
+        else
+        {
+            displacement = (int16_t)(int8_t)ReadByteFromMemory(machine, at);
+            IncrementAddress(at);
+        }
+
+        uint16_t size = ComputePhysicalAddress(at) - inst.address;
+        inst.operands[DEST] = {
+            .type = OpType_jmp,
+            .address = (uint32_t)displacement + size
+        };
+
+        inst.flags |= IPInc;
+    }
+
+    if constexpr (layout.fields[Data_bit].present)
+    {
+        inst.operands[!d] = {
+            .type = OpType_immediate,
+            .immediate = (int16_t)(int8_t)ReadByteFromMemory(machine, at)
+        };
+        IncrementAddress(at);
+    }
+
+    inst.size = ComputePhysicalAddress(at) - inst.address;
+    return inst;
+}
+
+typedef Instruction (*DecoderFunction)(Machine &machine, SegmentedAddress &at);
+
+template <size_t... EntryIndices>
+constexpr std::array<DecoderFunction, sizeof...(EntryIndices)> BuildSpecializedDecoders(std::index_sequence<EntryIndices...>)
+{
+    return { &DecodeSpecialized<EntryIndices>... };
+}
+
+/** One specialized decoder per InstructionTable entry, indexed like the table itself. */
+constexpr std::array<DecoderFunction, ArrayCount(InstructionTable)> SpecializedDecoders =
+    BuildSpecializedDecoders(std::make_index_sequence<ArrayCount(InstructionTable)>{});
+
+/* Length Decoding */
+
+#define MAX_LENGTH_GROUPS 16    // Group opcode bytes, whose length depends on the ModRM reg field
+
+/**
+ * Size of an instruction before its ModRM displacement. Derived from the same EntryLayouts the decoders use, but kept
+ * in its own small tables so scanning boundaries never touches LookupEntry or the ModRM descriptors.
+ */
+struct LengthDescriptor {
+    uint8_t length;     // Opcode, ModRM, immediate, address and jump displacement bytes. 0 when no entry matches.
+    uint8_t hasModRm;   // ModRM displacement bytes still have to be added
+    uint8_t group;      // 1-based row of LengthDescriptors::groups to look the ModRM reg field up in, 0 for none
+    Operation op;
+};
+
+struct LengthDescriptors {
+    LengthDescriptor descriptors[256];                  // By first byte
+    LengthDescriptor groups[MAX_LENGTH_GROUPS][8];      // By group, then ModRM reg
+    uint8_t displacementSizes[256];                     // By ModRM byte
+    uint8_t groupCount;
+    bool overflow;                  // More group opcode bytes than MAX_LENGTH_GROUPS
+    bool widthOutsideFirstByte;     // An entry keeps W or S outside its first byte, so the first byte can't fix the size
+};
+
+constexpr LengthDescriptor BuildLengthDescriptor(LengthDescriptors &table, int byte, uint8_t entry)
+{
+    LengthDescriptor descriptor = {};
+    if (entry == NO_ENTRY)
+    {
+        return descriptor;
+    }
+
+    const EntryLayout &layout = EntryLayouts[entry];
+    const FieldLayout &wField = layout.fields[W_bit];
+    const FieldLayout &sField = layout.fields[S_bit];
+    if ((!wField.isConstant && wField.byte != 0) || (!sField.isConstant && sField.byte != 0))
+    {
+        table.widthOutsideFirstByte = true;
+    }
+
+    uint8_t w = !wField.present ? 0 : wField.isConstant ? wField.value : (byte >> wField.shift) & wField.mask;
+    uint8_t s = !sField.present ? 0 : sField.isConstant ? sField.value : (byte >> sField.shift) & sField.mask;
+
+    uint8_t length = layout.opcodeBytes;
+    if (layout.fields[Imm_bit].present)
+    {
+        length += ((w == 1 && s == 1) || (w == 0)) ? 1 : 2;
+    }
+    if (layout.fields[Addr_bit].present)
+    {
+        length += 2;
+    }
+    if (layout.fields[Displacement_bit].present)
+    {
+        length += (w == 1) ? 2 : 1;
+    }
+    if (layout.fields[Data_bit].present)
+    {
+        length += 1;
+    }
+
+    descriptor.length = length;
+    descriptor.hasModRm = layout.fields[Mod_bit].present && !layout.fields[Mod_bit].isConstant;
+    descriptor.op = InstructionTable[entry].mnemonic;
+    return descriptor;
+}
+
+constexpr LengthDescriptors BuildLengthTable()
+{
+    LengthDescriptors table = {};
+
+    for (int byte = 0; byte < 256; byte++)
+    {
+        const OpcodeCandidates &candidates = OpcodeTable.candidates[byte];
+        if (!candidates.usesExtension)
+        {
+            table.descriptors[byte] = BuildLengthDescriptor(table, byte, (candidates.count == 0) ? NO_ENTRY : candidates.entries[0]);
+            continue;
+        }
+
+        if (table.groupCount == MAX_LENGTH_GROUPS)
+        {
+            table.overflow = true;
+            continue;
+        }
+
+        for (uint8_t extension = 0; extension < 8; extension++)
+        {
+            table.groups[table.groupCount][extension] = BuildLengthDescriptor(table, byte, candidates.extensions[extension]);
+        }
+        table.descriptors[byte].group = ++table.groupCount;
+    }
+
+    for (int modrm = 0; modrm < 256; modrm++)
+    {
+        uint8_t mod = modrm >> 6;
+        uint8_t rm = modrm & 0b111;
+        table.displacementSizes[modrm] = (mod == 0b01) ? 1 : (mod == 0b10 || (mod == 0b00 && rm == 0b110)) ? 2 : 0;
+    }
+
+    return table;
+}
+
+constexpr LengthDescriptors LengthTable = BuildLengthTable();
+
+static_assert(!LengthTable.overflow, "More group opcode bytes than MAX_LENGTH_GROUPS");
+
+static_assert(!LengthTable.widthOutsideFirstByte, "Length decoding expects W and S to live in the first instruction byte");
+
+/**
+ * Whole instruction length for a first byte and the byte after it, resolved through the group and displacement tables
+ * ahead of time. 0 when no entry matches.
+ */
+constexpr uint8_t LengthForPair(uint8_t first, uint8_t second)
+{
+    const LengthDescriptor &descriptor = LengthTable.descriptors[first];
+    const LengthDescriptor &resolved = descriptor.group ? LengthTable.groups[descriptor.group - 1][(second >> 3) & 0b111] :
+        descriptor;
+    if (resolved.length == 0)
+    {
+        return 0;
+    }
+
+    return resolved.hasModRm ? resolved.length + LengthTable.displacementSizes[second] : resolved.length;
+}
+
+/**
+ * The length tables flattened into one 64 KiB table indexed by the first two instruction bytes, first byte low. A
+ * length is then one 16-bit load and one table load, with no Operation, group or displacement lookups left.
+ */
+constexpr std::array<uint8_t, 256 * 256> BuildPairLengths()
+{
+    std::array<uint8_t, 256 * 256> table = {};
+    for (int pair = 0; pair < 256 * 256; pair++)
+    {
+        table[pair] = LengthForPair((uint8_t)(pair & 0xFF), (uint8_t)(pair >> 8));
+    }
+    return table;
+}
+
+constexpr std::array<uint8_t, 256 * 256> PairLengths = BuildPairLengths();
+
+/**
+ * Size in bytes of the instruction starting at `at` without decoding its operands. Returns 0 when no table entry
+ * matches. If `op` is given it receives the instruction's Operation. The byte after the opcode is only read when the
+ * instruction has a ModRM byte. Boundary scans that don't need the Operation use InstructionLength instead.
+ */
+inline uint8_t DecodeInstructionLength(const Machine &machine, SegmentedAddress at, Operation *op = nullptr)
+{
+    const LengthDescriptor *descriptor = &LengthTable.descriptors[ReadByteFromMemory(machine, at)];
+    if (!descriptor->hasModRm && !descriptor->group)
+    {
+        if (op)
+        {
+            *op = descriptor->op;
+        }
+        return descriptor->length;
+    }
+
+    IncrementAddress(at);
+    uint8_t modrm = ReadByteFromMemory(machine, at);
+    if (descriptor->group)
+    {
+        descriptor = &LengthTable.groups[descriptor->group - 1][(modrm >> 3) & 0b111];
+    }
+
+    if (op)
+    {
+        *op = descriptor->op;
+    }
+
+    return descriptor->hasModRm ? descriptor->length + LengthTable.displacementSizes[modrm] : descriptor->length;
+}
+
+/**
+ * Size in bytes of the instruction whose first byte is at `bytes`, or 0 when no table entry matches. Always reads the
+ * second byte, which the memory guard keeps in bounds at the top of the address space.
+ */
+inline uint8_t InstructionLength(const uint8_t *bytes)
+{
+    return PairLengths[bytes[0] | (bytes[1] << 8)];
+}
+
+/**
+ * Length of the instruction that would start at each of `count` consecutive bytes. The lookups don't depend on each
+ * other, so they overlap instead of waiting on the previous length the way a sweep does. A sweep then only has to step
+ * through `lengths`.
+ */
+void ScanInstructionLengths(const uint8_t *bytes, uint32_t count, uint8_t *lengths);
+
+/* Execution */
+
+#define EXECUTE_INSTRUCTION_LIMIT 100000000ull    // Stops runaway loops in images that never leave themselves
+
+// Labels as values are a GCC/Clang extension, everything else dispatches through the switch
+#if defined(__GNUC__) || defined(__clang__)
+#define SIM_COMPUTED_GOTO 1
+#else
+#define SIM_COMPUTED_GOTO 0
+#endif
+
+enum DispatchStrategy {
+    Dispatch_switch,        // One switch on the op shared by every instruction
+    Dispatch_threaded,      // Computed goto, each handler jumps straight to the next one. Falls back to the switch.
+
+    Dispatch_count
+};
+
+constexpr std::string_view DispatchNames[Dispatch_count] = { "switch", "threaded" };
+
+enum ExecutionStop {
+    Stop_none,
+    Stop_programEnd,        // CS:IP left the loaded image
+    Stop_undecodable,       // No instruction decodes at CS:IP
+    Stop_unsupported,       // Decoded, but not executable yet (IN, OUT). CS:IP is left on it.
+    Stop_limit,             // Ran the requested number of instructions
+
+    Stop_count
+};
+
+constexpr std::string_view StopNames[Stop_count] = {
+    "running", "end of program", "undecodable bytes", "unsupported instruction", "instruction limit"
+};
+
+struct ExecutionResult {
+    uint64_t instructions;
+    ExecutionStop stop;
+};
+
+constexpr std::array<uint8_t, 256> BuildParityTable()
+{
+    std::array<uint8_t, 256> table = {};
+    for (int value = 0; value < 256; value++)
+    {
+        int bits = 0;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            bits += (value >> bit) & 1;
+        }
+        table[value] = (bits % 2 == 0) ? Flag_parity : 0;
+    }
+    return table;
+}
+
+/** PF for each low result byte. */
+constexpr std::array<uint8_t, 256> ParityTable = BuildParityTable();
+
+/**
+ * CF alone, which ADC, SBB, INC and DEC need, without working out the other flags.
+ */
+inline uint16_t CarryFlag(const CPU &cpu)
+{
+    const LazyFlags &lazy = cpu.lazyFlags;
+    if (lazy.op == FlagsOp_none || lazy.keepCarry)
+    {
+        return cpu.flags & Flag_carry;
+    }
+
+    return (lazy.result > (lazy.wide ? 0xFFFFu : 0xFFu)) ? Flag_carry : 0;
+}
+
+/**
+ * Records an arithmetic result for the flags to be worked out from later. `a` and `b` are already masked to the width.
+ */
+inline void RecordFlags(CPU &cpu, FlagsOp op, uint16_t a, uint16_t b, uint32_t result, bool wide, bool keepCarry)
+{
+    if (keepCarry)
+    {
+        cpu.flags = (cpu.flags & ~Flag_carry) | CarryFlag(cpu);
+    }
+
+    cpu.lazyFlags = {
+        .result = result,
+        .a = a,
+        .b = b,
+        .op = op,
+        .wide = wide,
+        .keepCarry = keepCarry
+    };
+}
+
+/**
+ * Brings `flags` up to date with the last recorded result and returns it. Conditional jumps, LOOPZ/LOOPNZ and anything
+ * showing the flags go through here.
+ */
+inline uint16_t MaterializeFlags(CPU &cpu)
+{
+    LazyFlags &lazy = cpu.lazyFlags;
+    if (lazy.op == FlagsOp_none)
+    {
+        return cpu.flags;
+    }
+
+    uint32_t mask = lazy.wide ? 0xFFFF : 0xFF;
+    uint32_t sign = lazy.wide ? 0x8000 : 0x80;
+    uint32_t overflow = (lazy.op == FlagsOp_add) ? (lazy.a ^ lazy.result) & (lazy.b ^ lazy.result) :
+        (lazy.a ^ lazy.b) & (lazy.a ^ lazy.result);
+
+    uint16_t flags = ParityTable[lazy.result & 0xFF];
+    flags |= ((lazy.result & mask) == 0) ? Flag_zero : 0;
+    flags |= (lazy.result & sign) ? Flag_sign : 0;
+    flags |= (lazy.result > mask) ? Flag_carry : 0;
+    flags |= ((lazy.a ^ lazy.b ^ lazy.result) & 0x10) ? Flag_auxCarry : 0;
+    flags |= (overflow & sign) ? Flag_overflow : 0;
+
+    uint16_t updated = lazy.keepCarry ? (ARITHMETIC_FLAGS & ~Flag_carry) : ARITHMETIC_FLAGS;
+    cpu.flags = (cpu.flags & ~updated) | (flags & updated);
+    lazy.op = FlagsOp_none;
+    return cpu.flags;
+}
+
+/**
+ * Replaces the flags outright, dropping any pending result.
+ */
+inline void WriteFlags(CPU &cpu, uint16_t flags)
+{
+    cpu.flags = flags;
+    cpu.lazyFlags.op = FlagsOp_none;
+}
+
+/**
+ * Zeroes the registers and flags, points every segment register at the program's load segment and CS:IP at its first
+ * byte, and drops any blocks cached from an earlier image.
+ */
+void StartExecution(Machine &machine, const Program &program);
+
+/**
+ * Applies one decoded instruction to the machine. IP must already be past the instruction. Returns false for
+ * instructions that can't be executed.
+ */
+bool ExecuteInstruction(Machine &machine, const Instruction &inst);
+
+/**
+ * Executes from CS:IP until the program is left, something can't be run, or `limit` instructions have executed. With
+ * `useBlockCache` instructions come from the machine's block cache, otherwise every one is decoded as it is reached.
+ */
+ExecutionResult Run(Machine &machine, const Program &program, uint64_t limit, DispatchStrategy dispatch = Dispatch_threaded,
+    bool useBlockCache = true);
+
+/**
+ * Formats how a run ended and the final registers and flags, working out any pending flags first.
+ */
+void WriteExecutionState(OutputWriter &output, CPU &cpu, const ExecutionResult &result);
+
+/**
+ * Formats the block cache, chaining and return prediction counters.
+ */
+void WriteBlockCacheStats(OutputWriter &output, const BlockCacheStats &stats);
+
+/**
+ * Runs the program from its load address and prints the final registers, flags and block cache statistics.
+ */
+void Execute(Machine &machine, Program &program);
+
+/* Disassembly */
+
+/**
+ * Linear sweep from the program's load address, decoding into the machine's ring and formatting it into `output`.
+ */
+void Disassemble(Machine &machine, Program &program, OutputWriter &output);
+
+/* Parallel Disassembly */
+
+/**
+ * Decodes the instruction at a physical address. Returns false when no table entry matches.
+ */
+bool DecodeAtPhysical(Machine &machine, uint32_t address, Instruction &inst);
+
+/**
+ * Multi-threaded linear sweep producing exactly the listing Disassemble() does. Threads first find every chunk's exit
+ * for each possible entry offset using the length-only decoder, a serial merge then chains the real entry offsets from
+ * the start of the image, and finally the threads decode and format their chunks, which are written out in order.
+ */
+void DisassembleParallel(Machine &machine, Program &program, OutputWriter &output, uint32_t threadCount);
+
+/* Recursive Disassembly */
+
+/**
+ * Disassembles only the bytes reachable from the load address by following JMP/Jcc/LOOP/JCXZ targets from a worklist,
+ * then emits the image in address order with `L<n>:` labels on every jump target and `db` lines for bytes no path
+ * reaches, so embedded data tables aren't decoded as code. Targets wrap within the load segment. An instruction reached
+ * at a start inside an earlier one can't be listed in place, so it follows that instruction as a comment.
+ */
+void DisassembleRecursive(Machine &machine, Program &program, OutputWriter &output);
+
+/* Columnar Export */
+
+/**
+ * Binary export of a decoded listing. A ColumnarHeader is followed by one ColumnDescriptor per column, then every column
+ * as a contiguous little endian array of `instructionCount` fixed width values, starting on a COLUMNAR_ALIGNMENT
+ * boundary. Consumers can mmap the file and scan a column without parsing anything. New columns are only ever added
+ * with new ids, so readers skip ids they don't know; COLUMNAR_VERSION changes only when an existing column does.
+ */
+#define COLUMNAR_MAGIC 0x43363853   // "S86C"
+#define COLUMNAR_VERSION 1
+#define COLUMNAR_ALIGNMENT 64
+
+enum ColumnId: uint32_t {
+    Column_address,         // uint32_t physical address of the first byte
+    Column_size,            // uint8_t length in bytes
+    Column_op,              // uint8_t Operation
+    Column_flags,           // uint16_t Flags
+    Column_destKind,        // uint8_t OperandType
+    Column_srcKind,         // uint8_t OperandType
+    Column_destRegister,    // uint8_t register index | offset << PACKED_REGISTER_OFFSET_SHIFT, for register operands
+    Column_srcRegister,     // uint8_t as Column_destRegister
+    Column_addressing,      // uint8_t calculation type | PACKED_HAS_DISPLACEMENT, for the memory operand
+    Column_displacement,    // int32_t memory operand displacement, or jump target relative to the instruction
+    Column_immediate,       // int16_t immediate operand
+
+    Column_count
+};
+
+constexpr uint32_t ColumnWidths[Column_count] = { 4, 1, 1, 2, 1, 1, 1, 1, 1, 4, 2 };
+
+/**
+ * Header and descriptors are laid out in the file exactly as declared, little endian and without padding.
+ */
+struct ColumnarHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t columnCount;
+    uint64_t instructionCount;
+};
+
+struct ColumnDescriptor {
+    uint32_t id;        // ColumnId
+    uint32_t width;     // Bytes per value
+    uint64_t offset;    // From the start of the file
+};
+
+static_assert(sizeof(ColumnarHeader) == 16 && sizeof(ColumnDescriptor) == 16, "Columnar file layout changed");
+
+/**
+ * A decoded listing being built up column by column before it is written.
+ */
+struct InstructionColumns {
+    std::vector<uint8_t> columns[Column_count];
+    uint64_t count;
+};
+
+void AppendInstruction(InstructionColumns &columns, const Instruction &inst);
+
+void WriteInstructionColumns(const InstructionColumns &columns, OutputWriter &output);
+
+/**
+ * Linear sweep over the image, the same one Disassemble() does, writing the instructions as a columnar file instead of
+ * a listing.
+ */
+void ExportColumns(Machine &machine, Program &program, OutputWriter &output);
+
+/**
+ * Read-only view over an exported file, typically mmapped. `columns` point into the caller's bytes.
+ */
+struct ColumnarView {
+    uint64_t count;
+    const uint8_t *columns[Column_count];
+};
+
+/**
+ * Validates the header and column table of `size` bytes at `data`. Returns false if it isn't a version
+ * COLUMNAR_VERSION file or any known column is missing, has the wrong width or runs past the end.
+ */
+bool OpenColumnarView(ColumnarView &view, const uint8_t *data, size_t size);
+
+/**
+ * Rebuilds instruction `index` of a view. Compares equal to what the decoder produced for it.
+ */
+Instruction ReadColumnarInstruction(const ColumnarView &view, uint64_t index);
+
+/* Stream Generation */
+
+#define GENERATOR_MAX_RETRIES 1024  // Consecutive rejected encodings before a generator gives up on its weighting
+
+/**
+ * Writes a random encoding of InstructionTable[entry] to `out` straight from the entry's bit layout: variable fields
+ * (D, W, S, mod, reg, r/m) get random values, OpExtension its required bits, and displacement, immediate, address
+ * and data bytes are random. `inst` is built from those same field values, independently of the decoder, so it is what
+ * the encoding should decode to. Returns the encoding's length.
+ */
+uint8_t EncodeRandomInstruction(uint8_t entry, uint32_t &seed, uint8_t *out, Instruction &inst);
+
+struct GeneratedInstruction {
+    uint32_t address;   // Physical address of the first byte
+    uint8_t entry;      // InstructionTable index
+    Instruction instruction;    // Built from the generated fields, the expected decode
+};
+
+struct GeneratedStream {
+    std::vector<GeneratedInstruction> instructions;
+    uint32_t size;      // Bytes used from the start of memory
+};
+
+/**
+ * Fills up to `size` bytes of a machine's memory from address 0 with back to back random instructions. A mnemonic is
+ * picked with probability proportional to its entry in `weights`, indexed by Operation, then one of its table entries
+ * uniformly. Encodings the decoder would read as a different entry or length are drawn again, so a linear sweep over
+ * the result decodes exactly the generated instructions. The same seed and weights always give the same stream.
+ */
+GeneratedStream GenerateStream(Machine &machine, uint32_t size, const uint32_t weights[Op_count], uint32_t seed);
+
+/* Encoding */
+
+#define MAX_ENCODINGS 32
+#define VERIFY_REPORT_LIMIT 16  // Mismatches listed in detail before verification only counts them
+
+struct Encoding {
+    uint8_t bytes[MAX_INSTRUCTION_LENGTH];
+    uint8_t length;
+};
+
+/**
+ * Every byte sequence that decodes to a given instruction. The 8086 often has several: either direction bit for
+ * register to register forms, 8 or 16 bit displacements, sign extended immediates, accumulator short forms, ...
+ */
+struct Encodings {
+    Encoding items[MAX_ENCODINGS];
+    uint32_t count;
+};
+
+/**
+ * Inverts the decoder using the same EntryLayouts: for each table entry of the instruction's mnemonic and each choice
+ * of D, S and displacement width, binds the operands to the fields Decode() would read them from and keeps the
+ * encodings whose operands, width and flags all fit. The instruction's address and size are ignored.
+ */
+void EnumerateEncodings(const Instruction &inst, Encodings &encodings);
+
+/**
+ * Writes the shortest encoding of an instruction to `out`, preferring earlier table entries and D = 0 on ties, which
+ * matches what NASM emits for the forms it shares with the table. Returns its length, or 0 if nothing encodes it.
+ */
+uint8_t EncodeInstruction(const Instruction &inst, uint8_t *out);
+
+struct VerifyResult {
+    uint64_t instructions;
+    uint64_t mismatches;        // Decoded instructions whose bytes no encoding reproduces
+    uint64_t undecodedBytes;    // Bytes the sweep skipped because nothing decodes there
+};
+
+/**
+ * Linear sweep that re-encodes every decoded instruction and compares the encoding byte for byte with the instruction's
+ * bytes in the image. Where an instruction has several encodings the one matching the image is used. The first
+ * VERIFY_REPORT_LIMIT differences are written to `report` with the hex physical address, both byte sequences and the
+ * listing line.
+ */
+VerifyResult VerifyImage(Machine &machine, Program &program, OutputWriter &report);
+
+/* Program Loading */
+
+/**
+ * Parses a load address written as hex `segment:offset`, e.g. `1000:0100`.
+ */
+bool ParseSegmentedAddress(const char *text, SegmentedAddress &at);
+
+/**
+ * Clears a machine's address space and loads a binary image into it at `loadAddress`. On POSIX the zeroed address space
+ * is a fresh anonymous mapping and the file is mapped copy-on-write straight into it whenever the load address is page
+ * aligned, so a disassembly-only run never copies the image. Returns a program with `loaded` false on failure, with the
+ * reason in `error` when it is given and on stderr otherwise.
+ */
+Program LoadProgramIntoMemory(Machine &machine, std::string filePath, SegmentedAddress loadAddress = {},
+    std::string *error = nullptr);
+
+/* Batch Mode */
+
+/**
+ * Reads the images a batch covers: every .bin file in a directory (sorted by name), or the paths listed one per line in
+ * a manifest, skipping blank lines and `#` comments. Returns false if `source` can't be read.
+ */
+bool CollectBatchPaths(const std::string &source, std::vector<std::string> &paths);
+
+/**
+ * Disassembles every image of a batch on a pool of `threadCount` work-stealing workers, each with its own Machine, and
+ * writes the listings to `output` in batch order as soon as each one and all before it are done. With `execute` each
+ * image is run from its load address instead and the listing is replaced by its final state and block cache counters.
+ * Every listing is preceded by a `; <path>` line, and images that could not be loaded get the loader's error line there
+ * instead of on stderr. Decoder counters are added to `stats`. Every image is loaded at `loadAddress`. Returns the
+ * number of images that failed to load.
+ */
+uint32_t RunBatch(const std::vector<std::string> &paths, OutputWriter &output, DecodeStats &stats, uint32_t threadCount,
+    bool execute, bool recursive, SegmentedAddress loadAddress = {});
+
+#endif // SIM8086_H
@@ -0,0 +1,274 @@
+#include "libsim8086.h"
+#include "Sim8086.h"
+
+#include <new>
+
+struct sim8086_machine {
+    Machine machine;
+    Program program;
+    uint64_t executed;
+};
+
+static_assert((int)SIM8086_REG_COUNT == (int)Register_count, "Public register numbering must match RegisterIndex");
+static_assert((int)SIM8086_SEG_COUNT == (int)Segment_count, "Public segment numbering must match SegmentRegisters");
+static_assert((int)SIM8086_EA_BP == (int)Effective_addr_bp, "Public address modes must match EffectiveAddressCalculation");
+static_assert(SIM8086_FLAG_CARRY == Flag_carry && SIM8086_FLAG_PARITY == Flag_parity &&
+    SIM8086_FLAG_AUX_CARRY == Flag_auxCarry && SIM8086_FLAG_ZERO == Flag_zero && SIM8086_FLAG_SIGN == Flag_sign &&
+    SIM8086_FLAG_OVERFLOW == Flag_overflow, "Public flag bits must match CpuFlags");
+
+/**
+ * Maps the reason a run stopped to the status the API reports for it.
+ */
+static sim8086_status ToPublicStatus(ExecutionStop stop)
+{
+    switch (stop)
+    {
+        case Stop_programEnd: return SIM8086_END_OF_PROGRAM;
+        case Stop_undecodable: return SIM8086_ERROR_DECODE;
+        case Stop_unsupported: return SIM8086_UNSUPPORTED;
+        default: return SIM8086_OK;
+    }
+}
+
+/**
+ * Copies a decoded instruction into the public layout.
+ */
+static sim8086_instruction ToPublicInstruction(const Instruction &inst)
+{
+    sim8086_instruction result = {
+        .address = inst.address,
+        .mnemonic = inst.op,
+        .size = (uint8_t)inst.size,
+        .flags = (uint8_t)((inst.flags & Flags::Wide) ? SIM8086_INSTRUCTION_WIDE : 0)
+    };
+
+    // Internal operands are indexed by SRC/DEST, the public ones are destination first
+    const Operand *operands[2] = { &inst.operands[DEST], &inst.operands[SRC] };
+    for (int i = 0; i < 2; i++)
+    {
+        const Operand &op = *operands[i];
+        sim8086_operand &out = result.operands[i];
+        switch (op.type)
+        {
+            case OpType_register:
+                {
+                    out.type = SIM8086_OPERAND_REGISTER;
+                    out.reg = op.reg.index;
+                    out.part = op.reg.offset;
+                } break;
+            case OpType_effectiveAddrCalc:
+                {
+                    out.type = SIM8086_OPERAND_MEMORY;
+                    out.mode = op.expression.calculationType;
+                    out.value = (op.expression.calculationType == Effective_addr_direct_address)
+                        ? (uint16_t)op.expression.displacement
+                        : op.expression.displacement;
+                } break;
+            case OpType_immediate:
+                {
+                    out.type = SIM8086_OPERAND_IMMEDIATE;
+                    out.value = op.immediate;
+                } break;
+            case OpType_jmp:
+                {
+                    out.type = SIM8086_OPERAND_RELATIVE;
+                    out.value = (int32_t)op.address;
+                } break;
+            default:
+                {
+                    out.type = SIM8086_OPERAND_NONE;
+                }
+        }
+    }
+
+    return result;
+}
+
+extern "C" {
+
+sim8086_machine *sim8086_create(void)
+{
+    sim8086_machine *machine = new (std::nothrow) sim8086_machine();
+    if (machine && !InitMachine(machine->machine))
+    {
+        delete machine;
+        return nullptr;
+    }
+
+    return machine;
+}
+
+void sim8086_destroy(sim8086_machine *machine)
+{
+    if (!machine)
+    {
+        return;
+    }
+
+    ReleaseMachine(machine->machine);
+    delete machine;
+}
+
+sim8086_status sim8086_load(sim8086_machine *machine, const uint8_t *image, size_t size, uint16_t segment, uint16_t offset)
+{
+    if (!machine || (!image && size > 0))
+    {
+        return SIM8086_ERROR_ARGUMENT;
+    }
+
+    SegmentedAddress loadAddress = Create(segment, offset);
+    uint32_t start = ComputePhysicalAddress(loadAddress);
+    if (start >= MEMORY_SIZE || size > MEMORY_SIZE - start)
+    {
+        return SIM8086_ERROR_TOO_LARGE;
+    }
+
+    Machine &m = machine->machine;
+    memset(m.memory, 0, MEMORY_MAPPING_SIZE);
+    memcpy(m.memory + start, image, size);
+
+    machine->program = {
+        .size = (uint32_t)size,
+        .startAddr = start,
+        .endAddr = start + (uint32_t)size - 1,
+        .loadAddress = loadAddress,
+        .loaded = true
+    };
+
+    StartExecution(m, machine->program);
+    machine->executed = 0;
+
+    return SIM8086_OK;
+}
+
+size_t sim8086_decode(sim8086_machine *machine, uint32_t address, sim8086_instruction *out, size_t count)
+{
+    if (!machine || !out)
+    {
+        return 0;
+    }
+
+    const Program &program = machine->program;
+    size_t decoded = 0;
+    while (decoded < count && program.size > 0 && address >= program.startAddr && address <= program.endAddr)
+    {
+        Instruction inst = {};
+        if (!DecodeAtPhysical(machine->machine, address, inst))
+        {
+            break;
+        }
+
+        machine->machine.stats.instructions++;
+        out[decoded++] = ToPublicInstruction(inst);
+        address += inst.size;
+    }
+
+    return decoded;
+}
+
+sim8086_status sim8086_step(sim8086_machine *machine, sim8086_instruction *out)
+{
+    if (!machine)
+    {
+        return SIM8086_ERROR_ARGUMENT;
+    }
+
+    Machine &m = machine->machine;
+    const Program &program = machine->program;
+
+    SegmentedAddress at = Create(m.cpu.segmentRegisters[CS], m.cpu.IP);
+    uint32_t address = ComputePhysicalAddress(at);
+    if (program.size == 0 || address < program.startAddr || address > program.endAddr)
+    {
+        return SIM8086_END_OF_PROGRAM;
+    }
+
+    uint8_t entry = LookupEntry(m, at);
+    if (entry == NO_ENTRY)
+    {
+        return SIM8086_ERROR_DECODE;
+    }
+
+    Instruction inst = SpecializedDecoders[entry](m, at);
+    if (!inst.op)
+    {
+        return SIM8086_ERROR_DECODE;
+    }
+
+    if (out)
+    {
+        *out = ToPublicInstruction(inst);
+    }
+
+    // Executing expects IP past the instruction, and leaves it there when the instruction can't be run
+    uint16_t ip = m.cpu.IP;
+    m.cpu.IP = at.offset;
+    if (!ExecuteInstruction(m, inst))
+    {
+        m.cpu.IP = ip;
+        return SIM8086_UNSUPPORTED;
+    }
+
+    machine->executed++;
+    return SIM8086_OK;
+}
+
+sim8086_status sim8086_run(sim8086_machine *machine, uint64_t limit, uint64_t *stepped)
+{
+    if (!machine)
+    {
+        return SIM8086_ERROR_ARGUMENT;
+    }
+
+    ExecutionResult result = Run(machine->machine, machine->program, limit ? limit : UINT64_MAX);
+    machine->executed += result.instructions;
+
+    if (stepped)
+    {
+        *stepped = result.instructions;
+    }
+
+    return ToPublicStatus(result.stop);
+}
+
+void sim8086_get_state(const sim8086_machine *machine, sim8086_state *state)
+{
+    if (!machine || !state)
+    {
+        return;
+    }
+
+    // Working out pending flags only updates the cached copy, the architectural state is unchanged
+    CPU cpu = machine->machine.cpu;
+    for (int i = 0; i < SIM8086_REG_COUNT; i++)
+    {
+        state->registers[i] = cpu.registers[i];
+    }
+    for (int i = 0; i < SIM8086_SEG_COUNT; i++)
+    {
+        state->segments[i] = cpu.segmentRegisters[i];
+    }
+    state->ip = cpu.IP;
+    state->instructions = machine->machine.stats.instructions;
+    state->flags = MaterializeFlags(cpu);
+    state->executed = machine->executed;
+}
+
+int sim8086_read_memory(const sim8086_machine *machine, uint32_t address, uint8_t *out, size_t size)
+{
+    if (!machine || !out || address > MEMORY_SIZE || size > MEMORY_SIZE - address)
+    {
+        return 0;
+    }
+
+    memcpy(out, machine->machine.memory + address, size);
+    return 1;
+}
+
+const char *sim8086_mnemonic(uint16_t mnemonic)
+{
+    // Mnemonics are string_views over literals, so they are null terminated
+    return (mnemonic < ArrayCount(Mnemonics)) ? Mnemonics[mnemonic].data() : nullptr;
+}
+
+}
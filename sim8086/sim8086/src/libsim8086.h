@@ -0,0 +1,205 @@
+#ifndef LIBSIM8086_H
+#define LIBSIM8086_H
+
+/**
+ * Embedding API for the simulator. Everything here is plain C so tools in any language can load images, decode
+ * instructions into their own arrays, and step machines in-process instead of spawning sim8086 and parsing its
+ * listing. Enum values and struct layouts only ever grow at the end; SIM8086_API_VERSION is bumped when they do.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM8086_API_VERSION 2
+
+typedef struct sim8086_machine sim8086_machine;
+
+typedef enum sim8086_status {
+    SIM8086_OK = 0,
+    SIM8086_ERROR_ARGUMENT,     // Null machine/buffer or an address outside the 1 MiB address space
+    SIM8086_ERROR_TOO_LARGE,    // The image does not fit between the load address and the top of memory
+    SIM8086_ERROR_DECODE,       // No instruction decodes at CS:IP
+    SIM8086_END_OF_PROGRAM,     // CS:IP has moved past the loaded image
+    SIM8086_UNSUPPORTED         // The instruction at CS:IP decodes but can't be executed yet (IN, OUT). CS:IP stays on it.
+} sim8086_status;
+
+/** Register numbering shared by operands and sim8086_state.registers. */
+typedef enum sim8086_register {
+    SIM8086_REG_AX,
+    SIM8086_REG_BX,
+    SIM8086_REG_CX,
+    SIM8086_REG_DX,
+    SIM8086_REG_SP,
+    SIM8086_REG_BP,
+    SIM8086_REG_SI,
+    SIM8086_REG_DI,
+
+    SIM8086_REG_COUNT
+} sim8086_register;
+
+typedef enum sim8086_segment {
+    SIM8086_SEG_CS,
+    SIM8086_SEG_SS,
+    SIM8086_SEG_DS,
+    SIM8086_SEG_ES,
+
+    SIM8086_SEG_COUNT
+} sim8086_segment;
+
+/** Which part of a register an operand names. */
+typedef enum sim8086_register_part {
+    SIM8086_PART_LOW,       // AL, BL, ...
+    SIM8086_PART_HIGH,      // AH, BH, ...
+    SIM8086_PART_WORD       // AX, BX, ...
+} sim8086_register_part;
+
+/** Base/index combination of a memory operand. */
+typedef enum sim8086_address_mode {
+    SIM8086_EA_DIRECT,
+    SIM8086_EA_BX_SI,
+    SIM8086_EA_BX_DI,
+    SIM8086_EA_BP_SI,
+    SIM8086_EA_BP_DI,
+    SIM8086_EA_SI,
+    SIM8086_EA_DI,
+    SIM8086_EA_BX,
+    SIM8086_EA_BP
+} sim8086_address_mode;
+
+typedef enum sim8086_operand_type {
+    SIM8086_OPERAND_NONE,
+    SIM8086_OPERAND_REGISTER,
+    SIM8086_OPERAND_MEMORY,
+    SIM8086_OPERAND_IMMEDIATE,
+    SIM8086_OPERAND_RELATIVE    // Jump target relative to the start of the instruction
+} sim8086_operand_type;
+
+typedef struct sim8086_operand {
+    uint8_t type;               // sim8086_operand_type
+    uint8_t reg;                // REGISTER: sim8086_register
+    uint8_t part;               // REGISTER: sim8086_register_part
+    uint8_t mode;               // MEMORY: sim8086_address_mode
+    int32_t value;              // IMMEDIATE: the value, MEMORY: displacement (address for DIRECT), RELATIVE: offset
+} sim8086_operand;
+
+#define SIM8086_INSTRUCTION_WIDE (1 << 0)   // Operates on words rather than bytes
+
+typedef struct sim8086_instruction {
+    uint32_t address;           // Physical address of the first byte
+    uint16_t mnemonic;          // Index into the instruction table's mnemonics, see sim8086_mnemonic()
+    uint8_t size;               // Length in bytes
+    uint8_t flags;              // SIM8086_INSTRUCTION_* bits
+    sim8086_operand operands[2];    // Destination first, then source
+} sim8086_instruction;
+
+/** Bits of sim8086_state.flags, at their 8086 positions. */
+#define SIM8086_FLAG_CARRY      (1 << 0)
+#define SIM8086_FLAG_PARITY     (1 << 2)
+#define SIM8086_FLAG_AUX_CARRY  (1 << 4)
+#define SIM8086_FLAG_ZERO       (1 << 6)
+#define SIM8086_FLAG_SIGN       (1 << 7)
+#define SIM8086_FLAG_OVERFLOW   (1 << 11)
+
+typedef struct sim8086_state {
+    uint16_t registers[SIM8086_REG_COUNT];
+    uint16_t segments[SIM8086_SEG_COUNT];
+    uint16_t ip;
+    uint64_t instructions;      // Instructions decoded by sim8086_decode since the machine was created
+    uint16_t flags;             // SIM8086_FLAG_* bits
+    uint64_t executed;          // Instructions executed since the last sim8086_load
+} sim8086_state;
+
+/** Creates a machine with a zeroed 1 MiB address space, or returns null if it can't be allocated. */
+sim8086_machine *sim8086_create(void);
+void sim8086_destroy(sim8086_machine *machine);
+
+/**
+ * Clears the machine's memory, registers and flags, copies `size` bytes of `image` to `segment:offset`, points CS:IP at
+ * the first byte and SS, DS and ES at `segment`. SP starts at 0, so the first push lands at the top of the segment.
+ */
+sim8086_status sim8086_load(sim8086_machine *machine, const uint8_t *image, size_t size, uint16_t segment, uint16_t offset);
+
+/**
+ * Decodes up to `count` consecutive instructions starting at a physical address into `out`, stopping early at the end
+ * of the loaded image or at bytes that don't decode. Returns the number of instructions written.
+ */
+size_t sim8086_decode(sim8086_machine *machine, uint32_t address, sim8086_instruction *out, size_t count);
+
+/**
+ * Executes the instruction at CS:IP and, if `out` isn't null, stores its decoded form there. IP wraps within CS like it
+ * does on the 8086.
+ */
+sim8086_status sim8086_step(sim8086_machine *machine, sim8086_instruction *out);
+
+/**
+ * Executes until CS:IP leaves the image, something doesn't decode or can't be executed, or `limit` instructions have
+ * run (0 for no limit). The number of instructions executed goes to `stepped` when it isn't null. Returns the reason
+ * the run stopped, or SIM8086_OK when the limit was reached.
+ */
+sim8086_status sim8086_run(sim8086_machine *machine, uint64_t limit, uint64_t *stepped);
+
+void sim8086_get_state(const sim8086_machine *machine, sim8086_state *state);
+
+/** Copies `size` bytes of memory starting at a physical address. Returns false if the range leaves the 1 MiB space. */
+int sim8086_read_memory(const sim8086_machine *machine, uint32_t address, uint8_t *out, size_t size);
+
+/** Upper case mnemonic for sim8086_instruction.mnemonic, or null if it is out of range. */
+const char *sim8086_mnemonic(uint16_t mnemonic);
+
+#ifdef __cplusplus
+}
+
+#include <vector>
+
+namespace sim8086 {
+
+/**
+ * Owning C++ wrapper around a sim8086_machine.
+ */
+class Simulator
+{
+public:
+    Simulator() : machine(sim8086_create()) {}
+    ~Simulator() { sim8086_destroy(machine); }
+
+    Simulator(const Simulator&) = delete;
+    Simulator &operator=(const Simulator&) = delete;
+
+    bool Valid() const { return machine != nullptr; }
+
+    sim8086_status Load(const std::vector<uint8_t> &image, uint16_t segment = 0, uint16_t offset = 0)
+    {
+        return sim8086_load(machine, image.data(), image.size(), segment, offset);
+    }
+
+    std::vector<sim8086_instruction> Decode(uint32_t address, size_t count)
+    {
+        std::vector<sim8086_instruction> instructions(count);
+        instructions.resize(sim8086_decode(machine, address, instructions.data(), count));
+        return instructions;
+    }
+
+    sim8086_status Step(sim8086_instruction *out = nullptr) { return sim8086_step(machine, out); }
+    sim8086_status Run(uint64_t limit = 0, uint64_t *stepped = nullptr) { return sim8086_run(machine, limit, stepped); }
+
+    sim8086_state State() const
+    {
+        sim8086_state state = {};
+        sim8086_get_state(machine, &state);
+        return state;
+    }
+
+    sim8086_machine *Handle() { return machine; }
+
+private:
+    sim8086_machine *machine;
+};
+
+}
+#endif
+
+#endif // LIBSIM8086_H
@@ -0,0 +1,4 @@
+bits 16
+
+	MOV [12], AX
+	MOV [1234], AL
@@ -0,0 +1,5 @@
+bits 16
+
+	ADC AX, 300
+	ADC AX, 12
+	ADC AL, -36
@@ -0,0 +1,11 @@
+bits 16
+
+	ADC BL, 12
+	ADC CX, 1000
+	ADC word [BP + DI], 17
+	ADC word [BP + DI + 7], 26
+	ADC word [BX - 1234], 45
+	ADC word [BP + DI], 260
+	ADC word [BP + DI], 8
+	ADC word [BP + DI], -8
+	ADC word [BP + DI + 7], -27
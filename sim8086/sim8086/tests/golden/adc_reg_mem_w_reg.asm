@@ -0,0 +1,5 @@
+bits 16
+
+	ADC BX, [BX + SI]
+	ADC BX, CX
+	ADC BL, CL
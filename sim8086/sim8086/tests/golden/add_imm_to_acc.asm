@@ -0,0 +1,8 @@
+bits 16
+
+	ADD AX, 18
+	ADD AX, 270
+	ADD AX, -170
+	ADD AX, -270
+	ADD AL, 15
+	ADD AL, -18
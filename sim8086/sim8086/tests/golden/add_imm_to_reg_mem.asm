@@ -0,0 +1,11 @@
+bits 16
+
+	ADD BL, 12
+	ADD CX, 1000
+	ADD word [BP + DI], 17
+	ADD word [BP + DI + 7], 26
+	ADD word [BX - 1234], 45
+	ADD word [BP + DI], 260
+	ADD word [BP + DI], 8
+	ADD word [BP + DI], -8
+	ADD word [BP + DI + 7], -27
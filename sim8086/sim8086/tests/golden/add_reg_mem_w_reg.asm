@@ -0,0 +1,5 @@
+bits 16
+
+	ADD BX, [BX + SI]
+	ADD BX, CX
+	ADD BL, CL
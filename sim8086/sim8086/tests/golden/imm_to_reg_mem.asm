@@ -0,0 +1,6 @@
+bits 16
+
+	MOV byte [BX + DI], 12
+	MOV BX, 12
+	MOV AX, [12]
+	MOV AL, [1234]
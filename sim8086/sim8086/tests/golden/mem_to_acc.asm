@@ -0,0 +1,3 @@
+bits 16
+
+	MOV AX, [12]
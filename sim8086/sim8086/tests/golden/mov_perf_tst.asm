@@ -0,0 +1,267 @@
+bits 16
+
+	MOV CX, BX
+	MOV AL, BL
+	MOV BX, CX
+	MOV DX, AX
+	MOV SI, DI
+	MOV DI, SI
+	MOV BP, SP
+	MOV SP, BP
+	MOV AH, CH
+	MOV BH, DH
+	MOV CL, DL
+	MOV DH, BH
+	MOV AX, DX
+	MOV BX, SI
+	MOV CX, DI
+	MOV DX, BP
+	MOV SI, BX
+	MOV DI, CX
+	MOV BP, DX
+	MOV AX, CX
+	MOV BX, DX
+	MOV CX, SI
+	MOV DX, DI
+	MOV SI, AX
+	MOV DI, BX
+	MOV BP, CX
+	MOV AX, SI
+	MOV BX, DI
+	MOV CX, BP
+	MOV DX, AX
+	MOV AL, AH
+	MOV BL, BH
+	MOV CL, CH
+	MOV DL, DH
+	MOV AH, AL
+	MOV BH, BL
+	MOV CH, CL
+	MOV DH, DL
+	MOV AL, CL
+	MOV BL, DL
+	MOV CL, AL
+	MOV DL, BL
+	MOV AL, DL
+	MOV BL, CL
+	MOV CL, BL
+	MOV DL, AL
+	MOV AH, BH
+	MOV BH, CH
+	MOV CH, DH
+	MOV DH, AH
+	MOV AL, BL
+	MOV BL, AL
+	MOV CL, DL
+	MOV DL, CL
+	MOV CX, [BX + SI]
+	MOV AL, [BX + DI]
+	MOV DX, [BP + SI]
+	MOV BX, [BP + DI]
+	MOV AX, [SI]
+	MOV CX, [DI]
+	MOV DX, [BX]
+	MOV SI, [BX + SI]
+	MOV DI, [BX + DI]
+	MOV BP, [BP + SI]
+	MOV AX, [BP + DI]
+	MOV BX, [SI]
+	MOV CX, [DI]
+	MOV BL, [BX + SI]
+	MOV CL, [BX + DI]
+	MOV DL, [BP + SI]
+	MOV AH, [BP + DI]
+	MOV BH, [SI]
+	MOV CH, [DI]
+	MOV DH, [BX]
+	MOV AX, [BX + SI]
+	MOV BX, [BX + DI]
+	MOV CX, [BP + SI]
+	MOV DX, [BP + DI]
+	MOV SI, [SI]
+	MOV DI, [DI]
+	MOV AX, [7]
+	MOV AL, [1234]
+	MOV AX, [243]
+	MOV AL, [2]
+	MOV BX, [1234]
+	MOV CX, [100]
+	MOV DX, [200]
+	MOV SI, [300]
+	MOV DI, [400]
+	MOV BP, [500]
+	MOV BL, [2000]
+	MOV CL, [3000]
+	MOV DL, [4000]
+	MOV AH, [5000]
+	MOV BH, [6000]
+	MOV CH, [7000]
+	MOV DH, [8000]
+	MOV BX, [10000]
+	MOV CX, [11000]
+	MOV DX, [12000]
+	MOV SI, [-5536]
+	MOV DI, [-6536]
+	MOV BP, [-7536]
+	MOV BL, [-8536]
+	MOV CX, [BX + SI + 4]
+	MOV AX, [BX + DI + 8]
+	MOV DX, [BP + SI + 16]
+	MOV BX, [BP + DI + 32]
+	MOV SI, [SI + 64]
+	MOV DI, [DI + 127]
+	MOV BP, [BX + 100]
+	MOV AL, [BX + SI + 1]
+	MOV BL, [BX + DI + 2]
+	MOV CL, [BP + SI + 3]
+	MOV DL, [BP + DI + 5]
+	MOV AH, [SI + 6]
+	MOV BH, [DI + 7]
+	MOV CH, [BX + 9]
+	MOV DH, [BX + SI + 10]
+	MOV AX, [BX + DI + 11]
+	MOV BX, [BP + SI + 12]
+	MOV CX, [BP + DI + 13]
+	MOV DX, [SI + 14]
+	MOV SI, [DI + 15]
+	MOV DI, [BX + 17]
+	MOV BP, [BX + SI + 18]
+	MOV AX, [BX + DI + 19]
+	MOV BX, [BP + SI + 20]
+	MOV CX, [BP + DI + 21]
+	MOV DX, [SI + 22]
+	MOV SI, [DI + 23]
+	MOV AL, [BX + 24]
+	MOV BL, [BX + SI + 25]
+	MOV CL, [BX + DI + 26]
+	MOV AX, [BX + DI + 3254]
+	MOV CX, [BX + SI - 3254]
+	MOV DX, [BP + SI + 1000]
+	MOV BX, [BP + DI + 2000]
+	MOV SI, [SI + 3000]
+	MOV DI, [DI + 4000]
+	MOV BP, [BX + 5000]
+	MOV AX, [BX + SI + 6000]
+	MOV BX, [BX + DI + 7000]
+	MOV CX, [BP + SI + 8000]
+	MOV DX, [BP + DI + 9000]
+	MOV SI, [SI + 10000]
+	MOV DI, [DI + 11000]
+	MOV BL, [BX + SI - 1000]
+	MOV CL, [BX + DI - 2000]
+	MOV DL, [BP + SI - 3000]
+	MOV AH, [BP + DI - 4000]
+	MOV BH, [SI + 500]
+	MOV CH, [DI + 600]
+	MOV DH, [BX + 700]
+	MOV AX, [BX + SI - 500]
+	MOV BX, [BX + DI - 600]
+	MOV CX, [BP + SI - 700]
+	MOV DX, [BP + DI - 800]
+	MOV SI, [SI + 15000]
+	MOV DI, [DI + 20000]
+	MOV BP, [BX + 25000]
+	MOV AX, [BX + SI + 30000]
+	MOV BX, [BX + DI - 30000]
+	MOV [BX + DI], CX
+	MOV [BP + SI], CL
+	MOV [BX + SI], AX
+	MOV [BX + DI], DX
+	MOV [BP + SI], SI
+	MOV [BP + DI], DI
+	MOV [SI], BX
+	MOV [DI], CX
+	MOV [BX], DX
+	MOV [BX + SI], AL
+	MOV [BX + DI], BL
+	MOV [BP + SI], CL
+	MOV [BP + DI], DL
+	MOV [SI], AH
+	MOV [DI], BH
+	MOV [BX], CH
+	MOV [BX + SI], DH
+	MOV [BX + DI], AX
+	MOV [BP + SI], BX
+	MOV [BP + DI], CX
+	MOV [BX + DI + 8], CX
+	MOV [BX + SI - 17], AX
+	MOV [BX + DI + 1], DX
+	MOV [BP + SI + 2], BX
+	MOV [BP + DI + 3], SI
+	MOV [SI + 4], DI
+	MOV [DI + 5], BP
+	MOV [BX + 6], AX
+	MOV [BX + SI + 7], AL
+	MOV [BX + DI + 9], BL
+	MOV [BP + SI + 10], CL
+	MOV [BP + DI + 11], DL
+	MOV [SI + 12], AH
+	MOV [DI + 13], BH
+	MOV [BX + 14], CH
+	MOV [BX + SI + 15], CX
+	MOV [BX + DI + 16], DX
+	MOV [BP + SI + 17], BX
+	MOV [BP + DI + 18], SI
+	MOV [SI + 19], DI
+	MOV [BX + DI + 3254], CX
+	MOV [BX + SI - 3254], AX
+	MOV [BX + DI + 1000], DX
+	MOV [BP + SI + 2000], BX
+	MOV [BP + DI + 3000], SI
+	MOV [SI + 4000], DI
+	MOV [DI + 5000], BP
+	MOV [BX + 6000], AX
+	MOV [BX + SI + 7000], AL
+	MOV [BX + DI + 8000], BL
+	MOV [BP + SI + 9000], CL
+	MOV [BP + DI + 10000], DL
+	MOV [SI + 11000], AH
+	MOV [DI + 12000], BH
+	MOV [BX + 13000], CH
+	MOV [BX + SI - 1000], CX
+	MOV [BX + DI - 2000], DX
+	MOV [BP + SI - 3000], BX
+	MOV [BP + DI - 4000], SI
+	MOV [SI - 5000], DI
+	MOV AX, 3
+	MOV BL, 9
+	MOV CX, 5328
+	MOV DX, 100
+	MOV SI, 200
+	MOV DI, 300
+	MOV BP, 400
+	MOV SP, 500
+	MOV AL, 1
+	MOV BL, 2
+	MOV CL, 3
+	MOV DL, 4
+	MOV AH, 5
+	MOV BH, 6
+	MOV CH, 7
+	MOV DH, 8
+	MOV AX, 1000
+	MOV BX, 2000
+	MOV CX, 3000
+	MOV DX, 4000
+	MOV SI, 5000
+	MOV DI, 6000
+	MOV BP, 7000
+	MOV SP, 8000
+	MOV AX, 32767
+	MOV BX, -1
+	MOV CX, 256
+	MOV DX, 512
+	MOV SI, 1024
+	MOV DI, 2048
+	MOV AL, -1
+	MOV BL, -128
+	MOV CL, 64
+	MOV DL, 32
+	MOV AH, 127
+	MOV BH, 63
+	MOV CH, 31
+	MOV DH, 15
+	MOV AX, 9999
+	MOV BX, 8888
+	MOV CX, 7777
+	MOV DX, 6666
@@ -0,0 +1,15 @@
+bits 16
+
+	MOV CX, BX
+	MOV AL, BL
+	MOV CX, [BX + SI]
+	MOV AL, [BX + DI]
+	MOV BX, [1234]
+	MOV CX, [BX + SI + 4]
+	MOV AX, [BX + DI + 3254]
+	MOV CX, [BX + SI - 3254]
+	MOV [BX + DI], CX
+	MOV [BX + DI + 8], CX
+	MOV [BX + SI - 17], BX
+	MOV [BX + DI], CX
+	MOV [BP + SI], CL
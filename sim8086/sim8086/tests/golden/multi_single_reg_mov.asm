@@ -0,0 +1,5 @@
+bits 16
+
+	MOV AX, BX
+	MOV CL, DL
+	MOV AX, SI
@@ -0,0 +1,15 @@
+bits 16
+
+	ADD CX, BX
+	ADD [BX + SI], CX
+	ADD [BX + SI + 5], DX
+	ADD BX, 18
+	ADD word [BX + SI + 17], 1024
+	ADD AX, 28
+	ADC BX, 33
+	ADC CX, BX
+	ADC [BX + SI], CX
+	ADC [BX + SI + 5], DX
+	ADC BX, 18
+	ADC word [BX + SI + 17], 1024
+	ADC AX, 28
@@ -0,0 +1,7 @@
+bits 16
+
+	CMP BX, CX
+	CMP [BP + DI], DX
+	CMP [BP + SI + 17], AX
+	CMP AX, 18
+	CMP word [BP + SI], 1023
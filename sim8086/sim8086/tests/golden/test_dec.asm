@@ -0,0 +1,9 @@
+bits 16
+
+	DEC BX
+	DEC word [BX + SI]
+	DEC word [BX + SI + 29]
+	NEG BX
+	INC BX
+	INC word [BX + SI]
+	INC byte [BX + SI + 29]
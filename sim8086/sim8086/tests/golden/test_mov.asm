@@ -0,0 +1,25 @@
+bits 16
+
+	MOV AX, BX
+	MOV CX, DX
+	MOV SI, BP
+	MOV AL, BL
+	MOV CL, DL
+	MOV CX, [BX + SI]
+	MOV BX, [BX + DI]
+	MOV DX, [39]
+	MOV CX, [-5]
+	MOV BX, [BX + SI + 12]
+	MOV CX, [BP + DI + 115]
+	MOV DX, [BP - 2]
+	MOV CX, [BP + DI - 115]
+	MOV CX, [BP + DI + 1024]
+	MOV DX, [BX + SI - 520]
+	MOV BX, [SI + 1040]
+	MOV byte [BX + SI], 17
+	MOV word [BX + 1024], 1243
+	MOV BX, 18
+	MOV AX, [18]
+	MOV AL, [56]
+	MOV [1024], AX
+	MOV [-5], AL
@@ -0,0 +1,8 @@
+bits 16
+
+	PUSH BX
+	PUSH word [BX + SI]
+	PUSH word [BX + SI + 29]
+	POP BX
+	POP word [BX + SI]
+	POP word [BX + SI + 29]
@@ -0,0 +1,14 @@
+bits 16
+
+	SUB CX, BX
+	SUB [BX + SI], CX
+	SUB [BX + SI + 5], DX
+	SUB BX, 18
+	SUB word [BX + SI + 17], 1024
+	SUB AX, 28
+	SBB CX, BX
+	SBB [BX + SI], CX
+	SBB [BX + SI + 5], DX
+	SBB BX, 18
+	SBB word [BX + SI + 17], 1024
+	SBB AX, 28
@@ -0,0 +1,15 @@
+bits 16
+
+	XCHG BX, DX
+	XCHG CX, [BX + SI]
+	XCHG CX, [BX + SI + 1024]
+	XCHG CX, [BX + SI - 37]
+	XCHG AX, CX
+	IN AX, 9
+	IN AL, 122
+	IN AX, DX
+	IN AL, DX
+	OUT 9, AX
+	OUT 122, AL
+	OUT DX, AX
+	OUT DX, AL
@@ -1,23 +1,1424 @@
-
 #include <stdio.h>
 #include <assert.h>
 
-// #include "Sim8086.cpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Sim8086.h"
+#include "libsim8086.h"
+
+#ifndef SIM_TESTS_DIR
+#define SIM_TESTS_DIR "tests"
+#endif
 
 
-// #define DisplaySuccessResult printf("%s..........SUCCESS\n", __func__)
-// #define DisplayFailureResult printf("%s..........FAIL\n", __func__)
+static int FailureCount = 0;
+static Machine Sim = {};
 
-// #define AssertEqual(arg1, arg2) do { \
-//         if (arg1 != arg2) { \
-//              DisplayFailureResult; \
-//              return; \
-//         }\
-//     } \
-//     while (0)
+#define DisplaySuccessResult printf("%s..........SUCCESS\n", __func__)
+#define DisplayFailureResult do { printf("%s..........FAIL (line %d)\n", __func__, __LINE__); FailureCount++; } while (0)
+
+#define AssertEqual(arg1, arg2) do { \
+        if ((arg1) != (arg2)) { \
+             DisplayFailureResult; \
+             return; \
+        }\
+    } \
+    while (0)
     
 
-// /* Unit Tests */
+std::vector<std::string> FixtureFiles()
+{
+    std::vector<std::string> files;
+    for (const auto &file : std::filesystem::directory_iterator(SIM_TESTS_DIR))
+    {
+        if (file.path().extension() == ".bin")
+        {
+            files.push_back(file.path().string());
+        }
+    }
+
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+/**
+ * Puts `bytes` at `load` in a freshly zeroed address space, the way sim8086_load does, so tests don't go through a file
+ * on disk. The machine also gets a full-size block cache, so a test that shrank it can't leave that behind.
+ */
+Program LoadTestImage(Machine &machine, const uint8_t *bytes, size_t size, SegmentedAddress load = {})
+{
+    uint32_t start = ComputePhysicalAddress(load);
+    memset(machine.memory, 0, MEMORY_MAPPING_SIZE);
+    memcpy(machine.memory + start, bytes, size);
+    InitBlockCache(machine.blocks, BLOCK_CACHE_BUDGET);
+
+    return {
+        .size = (uint32_t)size,
+        .startAddr = start,
+        .endAddr = start + (uint32_t)size - 1,
+        .loadAddress = load,
+        .loaded = true
+    };
+}
+
+Program LoadTestImage(Machine &machine, const std::vector<uint8_t> &bytes, SegmentedAddress load = {})
+{
+    return LoadTestImage(machine, bytes.data(), bytes.size(), load);
+}
+
+/* Unit Tests */
+
+void Test_LookupEntry_SelectsGroupEntryFromModRmReg()
+{
+    // SUB CX, 5 (0x83 /5)
+    Sim.memory[0] = 0x83;
+    Sim.memory[1] = 0xE9;
+    Sim.memory[2] = 0x05;
+    Sim.stats = {};
+
+    SegmentedAddress at = Create(0, 0);
+    uint8_t entry = LookupEntry(Sim, at);
+
+    AssertEqual(entry != NO_ENTRY, true);
+    AssertEqual(InstructionTable[entry].mnemonic, Op_SUB);
+
+    Instruction result = Decode(Sim, InstructionTable[entry], at);
+
+    AssertEqual(result.op, Op_SUB);
+    AssertEqual(at.offset, 3);
+    AssertEqual(Sim.stats.decodeAttempts, 1);
+    AssertEqual(Sim.stats.rejectedDecodes, 0);
+    AssertEqual(Sim.stats.speculativeDecodesAvoided, 2);
+
+    DisplaySuccessResult;
+}
+
+void Test_LookupEntry_MatchesCandidateWalk()
+{
+    // Every first byte with every ModRM reg value must select the same entry the speculative candidate walk finds
+    for (int byte = 0; byte < 256; byte++)
+    {
+        for (uint8_t reg = 0; reg < 8; reg++)
+        {
+            Sim.memory[0] = (uint8_t)byte;
+            Sim.memory[1] = 0b11000000 | (reg << 3);
+            Sim.memory[2] = 0;
+            Sim.memory[3] = 0;
+
+            Operation expected = None;
+            const OpcodeCandidates &candidates = OpcodeTable.candidates[byte];
+            for (int i = 0; i < candidates.count && expected == None; i++)
+            {
+                SegmentedAddress at = Create(0, 0);
+                expected = Decode(Sim, InstructionTable[candidates.entries[i]], at).op;
+            }
+
+            uint8_t entry = LookupEntry(Sim, Create(0, 0));
+            Operation result = (entry == NO_ENTRY) ? None : InstructionTable[entry].mnemonic;
+
+            AssertEqual(result, expected);
+        }
+    }
+
+    DisplaySuccessResult;
+}
+
+void Test_SpecializedDecoders_MatchInterpretedDecode()
+{
+    // Every first byte and ModRM byte, followed by displacement/immediate bytes that exercise sign extension
+    for (int byte = 0; byte < 256; byte++)
+    {
+        for (int modrm = 0; modrm < 256; modrm++)
+        {
+            Sim.memory[0] = (uint8_t)byte;
+            Sim.memory[1] = (uint8_t)modrm;
+            Sim.memory[2] = 0x85;
+            Sim.memory[3] = 0xF3;
+            Sim.memory[4] = 0x7A;
+            Sim.memory[5] = 0x91;
+
+            uint8_t entry = LookupEntry(Sim, Create(0, 0));
+            if (entry == NO_ENTRY)
+            {
+                continue;
+            }
+
+            SegmentedAddress interpretedAt = Create(0, 0);
+            SegmentedAddress specializedAt = Create(0, 0);
+            Instruction interpreted = Decode(Sim, InstructionTable[entry], interpretedAt);
+            Instruction specialized = SpecializedDecoders[entry](Sim, specializedAt);
+
+            AssertEqual(InstructionsEqual(interpreted, specialized), true);
+            AssertEqual(interpretedAt.offset, specializedAt.offset);
+        }
+    }
+
+    DisplaySuccessResult;
+}
+
+void Test_ModRmTable_DescribesOperandForms()
+{
+    // [BX + SI]
+    const ModRmDescriptor &bxSi = ModRmTable.descriptors[1][0b00000000];
+    AssertEqual(bxSi.type, OpType_effectiveAddrCalc);
+    AssertEqual(bxSi.calculationType, Effective_addr_bx_si);
+    AssertEqual(bxSi.base.index, Register_b);
+    AssertEqual(bxSi.index.index, Register_si);
+    AssertEqual(bxSi.displacementSize, 0);
+
+    // Direct address, 16-bit displacement without a base register
+    const ModRmDescriptor &direct = ModRmTable.descriptors[1][0b00000110];
+    AssertEqual(direct.calculationType, Effective_addr_direct_address);
+    AssertEqual(direct.displacementSize, 2);
+    AssertEqual(direct.hasDisplacement, FALSE);
+
+    // [BP + disp8] with CX in the reg field
+    const ModRmDescriptor &bp = ModRmTable.descriptors[1][0b01001110];
+    AssertEqual(bp.calculationType, Effective_addr_bp);
+    AssertEqual(bp.displacementSize, 1);
+    AssertEqual(bp.reg.index, Register_c);
+    AssertEqual(bp.reg.offset, FULL_BITS);
+
+    // Register mode, byte wide: r/m = BH, reg = DH
+    const ModRmDescriptor &bytes = ModRmTable.descriptors[0][0b11110111];
+    AssertEqual(bytes.type, OpType_register);
+    AssertEqual(bytes.rm.index, Register_b);
+    AssertEqual(bytes.rm.offset, HI_BITS);
+    AssertEqual(bytes.reg.index, Register_d);
+    AssertEqual(bytes.reg.offset, HI_BITS);
+
+    DisplaySuccessResult;
+}
+
+void Test_DecodeInstructionLength_MatchesDecodeForAllOpcodes()
+{
+    for (int byte = 0; byte < 256; byte++)
+    {
+        for (int modrm = 0; modrm < 256; modrm++)
+        {
+            Sim.memory[0] = (uint8_t)byte;
+            Sim.memory[1] = (uint8_t)modrm;
+
+            Operation op = None;
+            uint8_t length = DecodeInstructionLength(Sim, Create(0, 0), &op);
+            AssertEqual(InstructionLength(Sim.memory), length);
+
+            uint8_t entry = LookupEntry(Sim, Create(0, 0));
+            if (entry == NO_ENTRY)
+            {
+                AssertEqual(length, 0);
+                continue;
+            }
+
+            SegmentedAddress at = Create(0, 0);
+            Instruction inst = Decode(Sim, InstructionTable[entry], at);
+
+            AssertEqual(length, inst.size);
+            AssertEqual(op, inst.op);
+        }
+    }
+
+    DisplaySuccessResult;
+}
+
+void Test_DecodeInstructionLength_MatchesDecodeOnFixtures()
+{
+    std::vector<std::string> files = FixtureFiles();
+    AssertEqual(files.empty(), false);
+
+    for (const std::string &file : files)
+    {
+        Program program = LoadProgramIntoMemory(Sim, file);
+
+        SegmentedAddress at = Create(0, 0);
+        while (at.offset < program.size)
+        {
+            uint8_t entry = LookupEntry(Sim, at);
+            AssertEqual(entry != NO_ENTRY, true);
+
+            Operation op = None;
+            uint8_t length = DecodeInstructionLength(Sim, at, &op);
+            Instruction inst = Decode(Sim, InstructionTable[entry], at);
+
+            AssertEqual(length, inst.size);
+            AssertEqual(op, inst.op);
+        }
+
+        // The batched scan gives every byte its own length, or 1 where nothing decodes
+        std::vector<uint8_t> lengths(program.size);
+        ScanInstructionLengths(Sim.memory, program.size, lengths.data());
+        for (uint32_t offset = 0; offset < program.size; offset++)
+        {
+            uint8_t length = DecodeInstructionLength(Sim, Create(0, offset));
+            AssertEqual(lengths[offset], length ? length : 1);
+        }
+    }
+
+    DisplaySuccessResult;
+}
+
+void Test_LoadProgramIntoMemory_PlacesImageAtLoadAddress()
+{
+    std::string file = FixtureFiles().front();
+    std::ifstream stream(file, std::ios::binary);
+    std::vector<char> image((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+    // The page aligned load is mapped and the odd one is read in, both must land at segment * 16 + offset
+    SegmentedAddress loads[] = { Create(0x1000, 0x0000), Create(0x0123, 0x0007) };
+    for (SegmentedAddress load : loads)
+    {
+        Program program = LoadProgramIntoMemory(Sim, file, load);
+        AssertEqual(program.loaded, true);
+        AssertEqual(program.size, (uint32_t)image.size());
+        AssertEqual(program.startAddr, ComputePhysicalAddress(load));
+        AssertEqual(memcmp(Sim.memory + program.startAddr, image.data(), image.size()), 0);
+        AssertEqual(Sim.memory[program.startAddr - 1], 0);
+    }
+
+    Program tooHigh = LoadProgramIntoMemory(Sim, file, Create(0xFFFF, 0xFFFF));
+    AssertEqual(tooHigh.loaded, false);
+
+    SegmentedAddress parsed = {};
+    AssertEqual(ParseSegmentedAddress("1000:0100", parsed), true);
+    AssertEqual(parsed.segment, 0x1000);
+    AssertEqual(parsed.offset, 0x0100);
+    AssertEqual(ParseSegmentedAddress("10000:0", parsed), false);
+    AssertEqual(ParseSegmentedAddress("1000", parsed), false);
+
+    DisplaySuccessResult;
+}
+
+void Test_Disassemble_WalksImagesAcrossSegmentBoundaries()
+{
+    // 3 byte instructions so boundaries never line up with 64 KiB, and three segments' worth of them
+    const uint8_t addCx[] = { 0x83, 0xC1, 0x05 };   // ADD CX, 5
+    const uint32_t count = 70000;
+
+    std::vector<uint8_t> bytes;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        bytes.insert(bytes.end(), addCx, addCx + sizeof(addCx));
+    }
+
+    SegmentedAddress loads[] = { Create(0, 0), Create(0x1234, 0xFFF5) };
+    for (SegmentedAddress load : loads)
+    {
+        Program program = LoadTestImage(Sim, bytes, load);
+
+        static OutputWriter writer = {};
+        OpenOutput(writer, -1);
+
+        uint64_t before = Sim.stats.instructions;
+        Disassemble(Sim, program, writer);
+        AssertEqual(Sim.stats.instructions - before, count);
+    }
+
+    DisplaySuccessResult;
+}
+
+void Test_DisassembleRecursive_LabelsTargetsAndSkipsData()
+{
+    const uint8_t bytes[] = {
+        0xEB, 0x03,             // JMP L1
+        0x01, 0x02, 0x03,       // data a linear sweep would decode as ADD [BP + SI], AX
+        0x89, 0xD9,             // L1: MOV CX, BX
+        0x75, 0xFC,             // JNZ L1
+        0xC3,                   // RET
+        0x12, 0x34              // trailing data
+    };
+
+    Program program = LoadTestImage(Sim, bytes, sizeof(bytes), Create(0x0100, 0x0003));
+
+    static OutputWriter writer = {};
+    std::string actual;
+    OpenCapture(writer, &actual);
+    DisassembleRecursive(Sim, program, writer);
+    FlushOutput(writer);
+
+    std::string expected =
+        "\tJMP L1\n"
+        "\tdb 0x01, 0x02, 0x03\n"
+        "L1:\n"
+        "\tMOV CX, BX\n"
+        "\tJNZ L1\n"
+        "\tRET \n"
+        "\tdb 0x12, 0x34\n";
+
+    AssertEqual(actual, expected);
+    DisplaySuccessResult;
+}
+
+void Test_DisassembleRecursive_WrapsTargetsAndListsOverlaps()
+{
+    // JMP back from IP 0 wraps to IP 0xFFF4 in the same segment instead of leaving the image
+    const uint32_t size = 0x10000;
+    memset(Sim.memory, 0, size);
+    const uint8_t jump[] = { 0xEB, 0xF2 };                  // JMP L1
+    const uint8_t target[] = { 0x89, 0xD9, 0xC3 };          // L1: MOV CX, BX; RET
+    memcpy(Sim.memory, jump, sizeof(jump));
+    memcpy(Sim.memory + 0xFFF4, target, sizeof(target));
+
+    Program program = {
+        .size = size,
+        .startAddr = 0,
+        .endAddr = size - 1
+    };
+
+    std::string listing;
+    static OutputWriter writer = {};
+    OpenCapture(writer, &listing);
+    DisassembleRecursive(Sim, program, writer);
+    AssertEqual(listing.starts_with("\tJMP L1\n"), true);
+    AssertEqual(listing.find("L1:\n\tMOV CX, BX\n\tRET \n") != std::string::npos, true);
+
+    // JNZ lands inside the MOV its fall-through path decodes, so its target follows the MOV as a comment
+    const uint8_t overlap[] = {
+        0x75, 0x01,             // JNZ into the MOV below
+        0xB8, 0x90, 0xC3,       // MOV AX, 0xC390, or XCHG AX, AX; RET one byte in
+        0xC3                    // RET
+    };
+    memset(Sim.memory, 0, size);
+    memcpy(Sim.memory, overlap, sizeof(overlap));
+    program.size = sizeof(overlap);
+    program.endAddr = sizeof(overlap) - 1;
+
+    listing.clear();
+    OpenCapture(writer, &listing);
+    DisassembleRecursive(Sim, program, writer);
+    AssertEqual(listing, std::string(
+        "\tJNZ $+3\n"
+        "\tMOV AX, -15472\n"
+        "; also reached at +1, inside the instruction above:\n"
+        ";\tXCHG AX, AX\n"
+        "; also reached at +2, inside the instruction above:\n"
+        ";\tRET \n"
+        "\tRET \n"));
+
+    memset(Sim.memory, 0, size);
+    DisplaySuccessResult;
+}
+
+void Test_DisassembleParallel_MatchesSerialListing()
+{
+    // Random bytes are mostly invalid or misaligned code, the worst case for resynchronizing at chunk boundaries
+    const uint32_t size = 200 * 1024;
+    uint32_t seed = 0x8086;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        Sim.memory[i] = (uint8_t)(seed >> 16);
+    }
+
+    Program program = {
+        .size = size,
+        .startAddr = 0,
+        .endAddr = size - 1
+    };
+
+    std::string serial;
+    static OutputWriter writer = {};
+    OpenCapture(writer, &serial);
+    Disassemble(Sim, program, writer);
+
+    for (uint32_t threadCount : { 2, 3, 7 })
+    {
+        std::string parallel;
+        OpenCapture(writer, &parallel);
+        DisassembleParallel(Sim, program, writer, threadCount);
+        AssertEqual(parallel == serial, true);
+    }
+
+    memset(Sim.memory, 0, size);
+    DisplaySuccessResult;
+}
+
+void Test_RunBatch_MatchesPerFileListingsInOrder()
+{
+    std::vector<std::string> paths;
+    AssertEqual(CollectBatchPaths(SIM_TESTS_DIR, paths), true);
+    AssertEqual(paths, FixtureFiles());
+    paths.push_back("missing.bin");
+
+    static OutputWriter writer = {};
+    std::string expected;
+    OpenCapture(writer, &expected);
+    for (const std::string &path : paths)
+    {
+        std::string error;
+        Program program = LoadProgramIntoMemory(Sim, path, {}, &error);
+        WriteText(writer, "; " + path + (program.loaded ? "\n" : " could not be loaded\n") + error);
+        if (program.loaded)
+        {
+            Disassemble(Sim, program, writer);
+        }
+    }
+    FlushOutput(writer);
+
+    std::string actual;
+    OpenCapture(writer, &actual);
+    DecodeStats stats = {};
+    AssertEqual(RunBatch(paths, writer, stats, 3, false, false), 1u);
+    AssertEqual(actual == expected, true);
+
+    // Running instead captures each image's final state, still in batch order
+    std::string expectedStates;
+    OpenCapture(writer, &expectedStates);
+    for (const std::string &path : paths)
+    {
+        std::string error;
+        Program program = LoadProgramIntoMemory(Sim, path, {}, &error);
+        WriteText(writer, "; " + path + (program.loaded ? "\n" : " could not be loaded\n") + error);
+        if (program.loaded)
+        {
+            StartExecution(Sim, program);
+            Sim.blocks.stats = {};
+            ExecutionResult result = Run(Sim, program, EXECUTE_INSTRUCTION_LIMIT);
+            WriteExecutionState(writer, Sim.cpu, result);
+            WriteText(writer, "\n");
+            WriteBlockCacheStats(writer, Sim.blocks.stats);
+        }
+    }
+    FlushOutput(writer);
+
+    std::string states;
+    OpenCapture(writer, &states);
+    AssertEqual(RunBatch(paths, writer, stats, 3, true, false), 1u);
+    AssertEqual(states == expectedStates, true);
+    AssertEqual(states.find("Final registers:") != std::string::npos, true);
+    AssertEqual(states.find("Block chaining:") != std::string::npos, true);
+
+    // Every image goes to the given load address, where only the ones that fit in the last 16 bytes of memory load
+    uint32_t tooLarge = 0;
+    for (const std::string &path : FixtureFiles())
+    {
+        tooLarge += std::filesystem::file_size(path) > 16;
+    }
+
+    std::string high;
+    OpenCapture(writer, &high);
+    AssertEqual(RunBatch(paths, writer, stats, 3, false, false, Create(0xFFFF, 0x0000)), tooLarge + 1);
+
+    // Each load error is a whole line right under its own path, not interleaved on stderr
+    uint32_t errors = 0;
+    for (size_t at = high.find(" could not be loaded\nERROR: "); at != std::string::npos;
+        at = high.find(" could not be loaded\nERROR: ", at + 1))
+    {
+        errors++;
+    }
+    AssertEqual(errors, tooLarge + 1);
+
+    DisplaySuccessResult;
+}
+
+void Test_Machines_RunConcurrentlyWithoutSharingState()
+{
+    std::vector<std::string> files = FixtureFiles();
+
+    std::vector<std::string> expected(files.size());
+    static OutputWriter writer = {};
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        OpenCapture(writer, &expected[i]);
+        Program program = LoadProgramIntoMemory(Sim, files[i]);
+        Disassemble(Sim, program, writer);
+    }
+
+    // Every thread loads a different image into its own machine and disassembles it many times over
+    std::vector<std::string> actual(files.size());
+    std::vector<uint64_t> instructions(files.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        threads.emplace_back([&, i]() {
+            std::unique_ptr<Machine> machine = std::make_unique<Machine>();
+            std::unique_ptr<OutputWriter> output = std::make_unique<OutputWriter>();
+            InitMachine(*machine);
+
+            Program program = LoadProgramIntoMemory(*machine, files[i]);
+            for (int pass = 0; pass < 50; pass++)
+            {
+                actual[i].clear();
+                OpenCapture(*output, &actual[i]);
+                Disassemble(*machine, program, *output);
+            }
+
+            instructions[i] = machine->stats.instructions;
+            ReleaseMachine(*machine);
+        });
+    }
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        AssertEqual(actual[i] == expected[i], true);
+        AssertEqual(instructions[i] % 50, 0u);
+    }
+
+    DisplaySuccessResult;
+}
+
+void Test_LibraryApi_DecodesAndStepsImage()
+{
+    const std::vector<uint8_t> image = {
+        0xBB, 0x34, 0x12,       // MOV BX, 0x1234
+        0x89, 0xD9,             // MOV CX, BX
+        0x83, 0xC1, 0x05,       // ADD CX, 5
+        0x89, 0x0E, 0x40, 0x00, // MOV [0x0040], CX
+        0x81, 0xF9, 0x39, 0x12, // CMP CX, 0x1239
+        0xEB, 0xFE              // JMP $+0
+    };
+
+    sim8086::Simulator simulator;
+    AssertEqual(simulator.Valid(), true);
+    AssertEqual(simulator.Load(image, 0x1000, 0x0010), SIM8086_OK);
+
+    std::vector<sim8086_instruction> decoded = simulator.Decode(0x10010, 8);
+    AssertEqual(decoded.size(), 6u);
+
+    AssertEqual(std::string(sim8086_mnemonic(decoded[1].mnemonic)), std::string("MOV"));
+    AssertEqual(decoded[1].address, 0x10013u);
+    AssertEqual(decoded[1].size, 2);
+    AssertEqual(decoded[1].operands[0].type, SIM8086_OPERAND_REGISTER);
+    AssertEqual(decoded[1].operands[0].reg, SIM8086_REG_CX);
+    AssertEqual(decoded[1].operands[0].part, SIM8086_PART_WORD);
+    AssertEqual(decoded[1].operands[1].reg, SIM8086_REG_BX);
+
+    AssertEqual(std::string(sim8086_mnemonic(decoded[2].mnemonic)), std::string("ADD"));
+    AssertEqual(decoded[2].operands[1].type, SIM8086_OPERAND_IMMEDIATE);
+    AssertEqual(decoded[2].operands[1].value, 5);
+
+    AssertEqual(std::string(sim8086_mnemonic(decoded[5].mnemonic)), std::string("JMP"));
+    AssertEqual(decoded[5].operands[0].type, SIM8086_OPERAND_RELATIVE);
+    AssertEqual(decoded[5].operands[0].value, 0);
+
+    // Loading points the other segments at the image too, and leaves SP at the top of the stack segment
+    sim8086_state state = simulator.State();
+    AssertEqual(state.segments[SIM8086_SEG_SS], 0x1000);
+    AssertEqual(state.segments[SIM8086_SEG_DS], 0x1000);
+    AssertEqual(state.segments[SIM8086_SEG_ES], 0x1000);
+    AssertEqual(state.registers[SIM8086_REG_SP], 0);
+
+    sim8086_instruction stepped = {};
+    AssertEqual(simulator.Step(&stepped), SIM8086_OK);
+    AssertEqual(stepped.address, 0x10010u);
+    state = simulator.State();
+    AssertEqual(state.registers[SIM8086_REG_BX], 0x1234);
+    AssertEqual(state.ip, 0x0013);
+
+    // JMP $+0 keeps the run inside the image until the limit
+    uint64_t executed = 0;
+    AssertEqual(simulator.Run(10, &executed), SIM8086_OK);
+    AssertEqual(executed, 10u);
+
+    state = simulator.State();
+    AssertEqual(state.segments[SIM8086_SEG_CS], 0x1000);
+    AssertEqual(state.ip, 0x0010 + image.size() - 2);
+    AssertEqual(state.registers[SIM8086_REG_CX], 0x1239);
+    AssertEqual(state.flags & (SIM8086_FLAG_ZERO | SIM8086_FLAG_CARRY | SIM8086_FLAG_SIGN), SIM8086_FLAG_ZERO);
+    AssertEqual(state.executed, 11u);
+
+    uint8_t bytes[2] = {};
+    AssertEqual(sim8086_read_memory(simulator.Handle(), 0x10040, bytes, sizeof(bytes)), 1);
+    AssertEqual(bytes[0], 0x39);
+    AssertEqual(bytes[1], 0x12);
+
+    // IN decodes but isn't executable, so CS:IP stays on it
+    AssertEqual(simulator.Load({ 0x40, 0xE4, 0x10 }, 0x2000, 0), SIM8086_OK);
+    AssertEqual(simulator.Run(0, &executed), SIM8086_UNSUPPORTED);
+    AssertEqual(executed, 1u);
+    AssertEqual(simulator.Step(), SIM8086_UNSUPPORTED);
+    state = simulator.State();
+    AssertEqual(state.registers[SIM8086_REG_AX], 1);
+    AssertEqual(state.ip, 0x0001);
+
+    // A straight run off the end of the image
+    AssertEqual(simulator.Load({ 0x40, 0x40 }, 0x2000, 0), SIM8086_OK);
+    AssertEqual(simulator.Run(0, &executed), SIM8086_END_OF_PROGRAM);
+    AssertEqual(executed, 2u);
+    AssertEqual(simulator.Step(), SIM8086_END_OF_PROGRAM);
+
+    AssertEqual(simulator.Load(image, 0xFFFF, 0xFFFF), SIM8086_ERROR_TOO_LARGE);
+
+    DisplaySuccessResult;
+}
+
+void Test_InstructionRing_StreamsMoreThanCapacityInOrder()
+{
+    static InstructionRing ring = {};
+    uint32_t expected = 0;
+
+    for (uint32_t address = 0; address < BUFFER_SIZE * 3 + 7; address++)
+    {
+        if (RingIsFull(ring))
+        {
+            Instruction inst = {};
+            while (RingPop(ring, inst))
+            {
+                AssertEqual(inst.address, expected);
+                expected++;
+            }
+        }
+
+        Instruction inst = {};
+        inst.address = address;
+        RingPush(ring, inst);
+        AssertEqual(ring.head - ring.tail <= BUFFER_SIZE, true);
+    }
+
+    Instruction inst = {};
+    while (RingPop(ring, inst))
+    {
+        AssertEqual(inst.address, expected);
+        expected++;
+    }
+
+    AssertEqual(expected, BUFFER_SIZE * 3 + 7);
+    DisplaySuccessResult;
+}
+
+void Test_PackedInstruction_RoundTripsEveryDecodableOffset()
+{
+    const uint32_t size = 64 * 1024;
+    uint32_t seed = 0x1234;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        Sim.memory[i] = (uint8_t)(seed >> 16);
+    }
+
+    uint32_t decoded = 0;
+    for (uint32_t address = 0; address < size; address++)
+    {
+        Instruction inst = {};
+        if (!DecodeAtPhysical(Sim, address, inst))
+        {
+            continue;
+        }
+
+        AssertEqual(InstructionsEqual(UnpackInstruction(PackInstruction(inst)), inst), true);
+        decoded++;
+    }
+
+    memset(Sim.memory, 0, size);
+    AssertEqual(decoded > size / 2, true);
+    DisplaySuccessResult;
+}
+
+void Test_ExportColumns_RoundTripsSweepInstructions()
+{
+    const uint32_t size = 64 * 1024;
+    uint32_t seed = 0xC0DE;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        Sim.memory[i] = (uint8_t)(seed >> 16);
+    }
+
+    Program program = {
+        .size = size,
+        .startAddr = 0,
+        .endAddr = size - 1
+    };
+
+    std::string file;
+    static OutputWriter writer = {};
+    OpenCapture(writer, &file);
+    ExportColumns(Sim, program, writer);
+
+    ColumnarView view = {};
+    AssertEqual(OpenColumnarView(view, (const uint8_t *)file.data(), file.size()), true);
+
+    uint64_t index = 0;
+    uint32_t address = 0;
+    while (address < size)
+    {
+        Instruction inst = {};
+        if (!DecodeAtPhysical(Sim, address, inst))
+        {
+            address++;
+            continue;
+        }
+
+        AssertEqual(index < view.count, true);
+        AssertEqual(InstructionsEqual(ReadColumnarInstruction(view, index), inst), true);
+        address += inst.size;
+        index++;
+    }
+    AssertEqual(index, view.count);
+
+    // Every column starts aligned so a mapped file can be read in place
+    for (const uint8_t *column : view.columns)
+    {
+        AssertEqual((column - (const uint8_t *)file.data()) % COLUMNAR_ALIGNMENT, 0);
+    }
+
+    AssertEqual(OpenColumnarView(view, (const uint8_t *)file.data(), file.size() - 1), false);
+    file[0] ^= 0xFF;
+    AssertEqual(OpenColumnarView(view, (const uint8_t *)file.data(), file.size()), false);
+
+    memset(Sim.memory, 0, size);
+    DisplaySuccessResult;
+}
+
+void Test_GenerateStream_CoversEveryEntryAndModRmForm()
+{
+    uint32_t weights[Op_count] = {};
+    for (int op = None + 1; op < Op_count; op++)
+    {
+        weights[op] = 1;
+    }
+
+    const uint32_t size = 256 * 1024;
+    GeneratedStream stream = GenerateStream(Sim, size, weights, 0x5EED);
+    AssertEqual(stream.size + MAX_INSTRUCTION_LENGTH > size, true);
+
+    bool entries[ArrayCount(InstructionTable)] = {};
+    bool modRmForms[32] = {};
+    uint32_t address = 0;
+    for (const GeneratedInstruction &generated : stream.instructions)
+    {
+        // Back to back, and each one decodes as the entry it was generated from
+        AssertEqual(generated.address, address);
+
+        Instruction inst = {};
+        AssertEqual(DecodeAtPhysical(Sim, address, inst), true);
+        AssertEqual(inst.op, InstructionTable[generated.entry].mnemonic);
+        AssertEqual(InstructionsEqual(inst, generated.instruction), true);
+        address += inst.size;
+
+        entries[generated.entry] = true;
+        const FieldLayout &mod = EntryLayouts[generated.entry].fields[Mod_bit];
+        if (mod.present && !mod.isConstant)
+        {
+            uint8_t modrm = Sim.memory[generated.address + mod.byte];
+            modRmForms[((modrm >> 6) << 3) | (modrm & 0b111)] = true;
+        }
+    }
+    AssertEqual(address, stream.size);
+
+    for (bool seen : entries)
+    {
+        AssertEqual(seen, true);
+    }
+    for (bool seen : modRmForms)
+    {
+        AssertEqual(seen, true);
+    }
+
+    // Same seed and weights, same stream
+    std::vector<uint8_t> first(Sim.memory, Sim.memory + stream.size);
+    GeneratedStream again = GenerateStream(Sim, size, weights, 0x5EED);
+    AssertEqual(again.size, stream.size);
+    AssertEqual(memcmp(first.data(), Sim.memory, stream.size), 0);
+
+    // Weights restrict the mix
+    uint32_t onlyJnz[Op_count] = {};
+    onlyJnz[Op_JNZ] = 1;
+    GeneratedStream jumps = GenerateStream(Sim, 1024, onlyJnz, 1);
+    AssertEqual(jumps.instructions.empty(), false);
+    for (const GeneratedInstruction &generated : jumps.instructions)
+    {
+        AssertEqual(InstructionTable[generated.entry].mnemonic, Op_JNZ);
+    }
+
+    memset(Sim.memory, 0, size);
+    DisplaySuccessResult;
+}
+
+void Test_EncodeInstruction_PicksShortestNasmForm()
+{
+    const struct {
+        uint8_t bytes[MAX_INSTRUCTION_LENGTH];
+        uint8_t length;
+    } cases[] = {
+        { { 0x89, 0xD9 }, 2 },                  // MOV CX, BX
+        { { 0x83, 0xC0, 0x05 }, 3 },            // ADD AX, 5
+        { { 0x04, 0x05 }, 2 },                  // ADD AL, 5
+        { { 0x8B, 0x56, 0xFE }, 3 },            // MOV DX, [BP - 2]
+        { { 0xC7, 0x06, 0x34, 0x12, 0x07, 0x00 }, 6 },  // MOV word [4660], 7
+        { { 0x41 }, 1 },                        // INC CX
+        { { 0x75, 0xFE }, 2 },                  // JNZ $+0
+    };
+
+    for (const auto &test : cases)
+    {
+        memcpy(Sim.memory, test.bytes, sizeof(test.bytes));
+
+        Instruction inst = {};
+        AssertEqual(DecodeAtPhysical(Sim, 0, inst), true);
+
+        uint8_t encoded[MAX_INSTRUCTION_LENGTH] = {};
+        AssertEqual(EncodeInstruction(inst, encoded), test.length);
+        AssertEqual(memcmp(encoded, test.bytes, test.length), 0);
+    }
+
+    memset(Sim.memory, 0, MAX_INSTRUCTION_LENGTH);
+    DisplaySuccessResult;
+}
+
+void Test_VerifyImage_ReencodesFixturesAndGeneratedStreams()
+{
+    static OutputWriter writer = {};
+    std::string report;
+    OpenCapture(writer, &report);
+
+    for (const std::string &file : FixtureFiles())
+    {
+        Program program = LoadProgramIntoMemory(Sim, file);
+        VerifyResult result = VerifyImage(Sim, program, writer);
+        AssertEqual(result.instructions > 0, true);
+        AssertEqual(result.mismatches, 0u);
+        AssertEqual(result.undecodedBytes, 0u);
+    }
+
+    uint32_t weights[Op_count] = {};
+    for (int op = None + 1; op < Op_count; op++)
+    {
+        weights[op] = 1;
+    }
+
+    GeneratedStream stream = GenerateStream(Sim, 128 * 1024, weights, 0xE4C0);
+    Program program = {
+        .size = stream.size,
+        .startAddr = 0,
+        .endAddr = stream.size - 1
+    };
+
+    VerifyResult result = VerifyImage(Sim, program, writer);
+    AssertEqual(result.instructions, stream.instructions.size());
+    AssertEqual(result.mismatches, 0u);
+    AssertEqual(report.empty(), true);
+
+    // The canonical encoding may differ from the generated one, but it must decode back to the same instruction
+    const uint32_t scratch = 0xF0000;
+    for (const GeneratedInstruction &generated : stream.instructions)
+    {
+        Instruction inst = {};
+        DecodeAtPhysical(Sim, generated.address, inst);
+
+        uint8_t length = EncodeInstruction(inst, Sim.memory + scratch);
+        AssertEqual(length > 0, true);
+
+        Instruction decoded = {};
+        AssertEqual(DecodeAtPhysical(Sim, scratch, decoded), true);
+        AssertEqual(decoded.size, length);
+
+        decoded.address = inst.address;
+        decoded.size = inst.size;
+        AssertEqual(InstructionsEqual(decoded, inst), true);
+    }
+
+    memset(Sim.memory, 0, stream.size);
+    memset(Sim.memory + scratch, 0, MAX_INSTRUCTION_LENGTH);
+    DisplaySuccessResult;
+}
+
+void Test_Run_ExecutesArithmeticStackAndBranches()
+{
+    const uint8_t bytes[] = {
+        0xB8, 0xFF, 0x7F,           // MOV AX, 0x7FFF
+        0x05, 0x01, 0x00,           // ADD AX, 1
+        0x50,                       // PUSH AX
+        0x5E,                       // POP SI
+        0xB3, 0x00,                 // MOV BL, 0
+        0x80, 0xEB, 0x01,           // SUB BL, 1
+        0xB9, 0x03, 0x00,           // MOV CX, 3
+        0x42,                       // L1: INC DX
+        0xE2, 0xFD,                 // LOOP L1
+        0x89, 0x16, 0x00, 0x02,     // MOV [0x0200], DX
+        0x74, 0x02,                 // JZ L2
+        0xB7, 0x11,                 // MOV BH, 0x11
+        0x72, 0x02,                 // L2: JNAE L3
+        0xB7, 0x22,                 // MOV BH, 0x22
+        0xE4, 0x09                  // L3: IN AL, 9
+    };
+
+    // Each dispatch strategy, decoding every instruction and then running from the block cache
+    for (int run = 0; run < Dispatch_count * 2; run++)
+    {
+        DispatchStrategy dispatch = (DispatchStrategy)(run % Dispatch_count);
+        bool cached = run >= Dispatch_count;
+
+        Program program = LoadTestImage(Sim, bytes, sizeof(bytes), Create(0x1000, 0x0100));
+
+        // Stopping at the limit leaves the cache mid-block, and the second run has to pick up from there
+        StartExecution(Sim, program);
+        ExecutionResult limited = Run(Sim, program, 5, dispatch, cached);
+        AssertEqual(limited.stop, Stop_limit);
+        AssertEqual(limited.instructions, 5u);
+
+        ExecutionResult result = Run(Sim, program, EXECUTE_INSTRUCTION_LIMIT, dispatch, cached);
+        AssertEqual(result.stop, Stop_unsupported);
+        AssertEqual(result.instructions, 12u);
+
+        const CPU &cpu = Sim.cpu;
+        AssertEqual(cpu.registers[Register_a], 0x8000);
+        AssertEqual(cpu.registers[Register_b], 0x11FF);
+        AssertEqual(cpu.registers[Register_c], 0);
+        AssertEqual(cpu.registers[Register_d], 3);
+        AssertEqual(cpu.registers[Register_si], 0x8000);
+        AssertEqual(cpu.registers[Register_sp], 0);
+        AssertEqual(cpu.segmentRegisters[CS], 0x1000);
+        AssertEqual(cpu.IP, 0x0100 + sizeof(bytes) - 2);
+
+        // SUB BL, 1 borrowed, and INC leaves CF alone
+        AssertEqual(MaterializeFlags(Sim.cpu), Flag_carry | Flag_parity);
+
+        AssertEqual(Sim.memory[0x10200], 3);
+        AssertEqual(Sim.memory[0x1FFFE], 0x00);
+        AssertEqual(Sim.memory[0x1FFFF], 0x80);
+    }
+
+    DisplaySuccessResult;
+}
+
+void Test_Run_IndirectJumpsFollowTheDecodedForm()
+{
+    const uint8_t bytes[] = {
+        0xBB, 0x0F, 0x00,           // MOV BX, 0x000F
+        0xFF, 0xE3,                 // JMP BX
+        0xE4, 0x10,                 // IN AL, 10h
+        0x00, 0x00, 0x00,
+        0xBB, 0x20, 0x00,           // MOV BX, 0x0020
+        0xFF, 0x2F,                 // JMP far [BX]
+        0xE4, 0x11                  // IN AL, 11h
+    };
+
+    // Loaded at 1FFF:0005 so the last IN AL, 11h sits at 2000:0004. The decoder marks FF /5 as intersegment, FF /4 is
+    // a near jump.
+    Program program = LoadTestImage(Sim, bytes, sizeof(bytes), Create(0x1FFF, 0x0005));
+
+    Instruction nearJump = {};
+    Instruction farJump = {};
+    AssertEqual(DecodeAtPhysical(Sim, 0x1FFF8, nearJump), true);
+    AssertEqual(DecodeAtPhysical(Sim, 0x20002, farJump), true);
+    AssertEqual(nearJump.flags & CSInc, 0);
+    AssertEqual(farJump.flags & CSInc, (int)CSInc);
+
+    for (int run = 0; run < Dispatch_count * 2; run++)
+    {
+        DispatchStrategy dispatch = (DispatchStrategy)(run % Dispatch_count);
+        bool cached = run >= Dispatch_count;
+
+        program = LoadTestImage(Sim, bytes, sizeof(bytes), Create(0x1FFF, 0x0005));
+        StartExecution(Sim, program);
+
+        // The far pointer 2000:0004, where the IN AL, 11h waits
+        uint32_t pointer = ((uint32_t)Sim.cpu.segmentRegisters[DS] << 4) + 0x20;
+        const uint8_t target[] = { 0x04, 0x00, 0x00, 0x20 };
+        memcpy(Sim.memory + pointer, target, sizeof(target));
+
+        ExecutionResult result = Run(Sim, program, EXECUTE_INSTRUCTION_LIMIT, dispatch, cached);
+        AssertEqual(result.instructions, 4u);
+        AssertEqual(result.stop, Stop_unsupported);
+        AssertEqual(Sim.cpu.segmentRegisters[CS], 0x2000);
+        AssertEqual(Sim.cpu.IP, 0x0004);
+
+        memset(Sim.memory + pointer, 0, sizeof(target));
+    }
+
+    DisplaySuccessResult;
+}
+
+void Test_Run_ResumesCachedBlockOnlyAtIP()
+{
+    const uint8_t bytes[] = {
+        0xB8, 0x01, 0x00,           // MOV AX, 1
+        0xBB, 0x02, 0x00,           // MOV BX, 2
+        0xB9, 0x03, 0x00,           // MOV CX, 3
+        0xE4, 0x10,                 // IN AL, 10h
+        0xBA, 0x04, 0x00            // MOV DX, 4
+    };
+
+    for (int dispatch = 0; dispatch < Dispatch_count; dispatch++)
+    {
+        Program program = LoadTestImage(Sim, bytes, sizeof(bytes), Create(0x1000, 0));
+        StartExecution(Sim, program);
+
+        // Moving IP between limited runs skips MOV BX, 2 instead of resuming the cached block where it stopped
+        AssertEqual(Run(Sim, program, 1, (DispatchStrategy)dispatch, true).stop, Stop_limit);
+        Sim.cpu.IP = 6;
+        AssertEqual(Run(Sim, program, 1, (DispatchStrategy)dispatch, true).stop, Stop_limit);
+        AssertEqual(Sim.cpu.registers[Register_b], 0);
+        AssertEqual(Sim.cpu.registers[Register_c], 3);
+        AssertEqual(Sim.cpu.IP, 9);
+
+        // Every run stops at the IN again rather than carrying on past it
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            ExecutionResult result = Run(Sim, program, EXECUTE_INSTRUCTION_LIMIT, (DispatchStrategy)dispatch, true);
+            AssertEqual(result.stop, Stop_unsupported);
+            AssertEqual(result.instructions, 0u);
+            AssertEqual(Sim.cpu.IP, 9);
+            AssertEqual(Sim.cpu.registers[Register_d], 0);
+        }
+    }
+
+    DisplaySuccessResult;
+}
+
+void Test_Run_DispatchStrategiesAgreeOnFixtures()
+{
+    const uint64_t limit = 100000;
+
+    for (const std::string &file : FixtureFiles())
+    for (bool cached : { false, true })
+    {
+        CPU states[Dispatch_count] = {};
+        ExecutionResult results[Dispatch_count] = {};
+        std::vector<uint8_t> memory[Dispatch_count];
+
+        for (int dispatch = 0; dispatch < Dispatch_count; dispatch++)
+        {
+            Program program = LoadProgramIntoMemory(Sim, file);
+            StartExecution(Sim, program);
+            results[dispatch] = Run(Sim, program, limit, (DispatchStrategy)dispatch, cached);
+            MaterializeFlags(Sim.cpu);
+            states[dispatch] = Sim.cpu;
+            memory[dispatch].assign(Sim.memory, Sim.memory + 0x10000);
+        }
+
+        AssertEqual(results[Dispatch_threaded].instructions, results[Dispatch_switch].instructions);
+        AssertEqual(results[Dispatch_threaded].stop, results[Dispatch_switch].stop);
+        const CPU &threaded = states[Dispatch_threaded];
+        const CPU &switched = states[Dispatch_switch];
+        AssertEqual(memcmp(threaded.registers, switched.registers, sizeof(threaded.registers)), 0);
+        AssertEqual(memcmp(threaded.segmentRegisters, switched.segmentRegisters, sizeof(threaded.segmentRegisters)), 0);
+        AssertEqual(threaded.IP, switched.IP);
+        AssertEqual(threaded.flags, switched.flags);
+        AssertEqual(memory[Dispatch_threaded] == memory[Dispatch_switch], true);
+    }
+
+    DisplaySuccessResult;
+}
+
+struct EagerResult {
+    uint16_t value;
+    uint16_t flags;
+};
+
+/**
+ * Reference for the arithmetic flags, worked out straight from their definitions on signed and unsigned values rather
+ * than with the bit tricks the lazy path uses.
+ */
+EagerResult EagerArithmetic(Operation op, uint16_t a, uint16_t b, uint16_t before, bool wide)
+{
+    int32_t bits = wide ? 16 : 8;
+    int32_t mask = (1 << bits) - 1;
+    int32_t carry = before & Flag_carry;
+    a &= mask;
+    b &= mask;
+
+    auto toSigned = [&](int32_t value) { return (value & (1 << (bits - 1))) ? value - (1 << bits) : value; };
+
+    bool subtract = (op == Op_SUB || op == Op_SBB || op == Op_CMP || op == Op_DEC || op == Op_NEG);
+    bool keepCarry = (op == Op_INC || op == Op_DEC);
+    int32_t lhs = (op == Op_NEG) ? 0 : a;
+    int32_t rhs = (op == Op_INC || op == Op_DEC) ? 1 : (op == Op_NEG) ? a : b;
+    int32_t carryIn = (op == Op_ADC || op == Op_SBB) ? carry : 0;
+
+    int32_t unsignedResult = subtract ? lhs - rhs - carryIn : lhs + rhs + carryIn;
+    int32_t signedResult = subtract ? toSigned(lhs) - toSigned(rhs) - carryIn : toSigned(lhs) + toSigned(rhs) + carryIn;
+    int32_t nibble = subtract ? (lhs & 0xF) - (rhs & 0xF) - carryIn : (lhs & 0xF) + (rhs & 0xF) + carryIn;
+    int32_t value = unsignedResult & mask;
+
+    int ones = 0;
+    for (int bit = 0; bit < 8; bit++)
+    {
+        ones += (value >> bit) & 1;
+    }
+
+    uint16_t flags = before & ~ARITHMETIC_FLAGS;
+    flags |= keepCarry ? carry : (unsignedResult < 0 || unsignedResult > mask) ? Flag_carry : 0;
+    flags |= (ones % 2 == 0) ? Flag_parity : 0;
+    flags |= (nibble < 0 || nibble > 0xF) ? Flag_auxCarry : 0;
+    flags |= (value == 0) ? Flag_zero : 0;
+    flags |= (value >> (bits - 1)) ? Flag_sign : 0;
+    flags |= (signedResult < -(1 << (bits - 1)) || signedResult >= (1 << (bits - 1))) ? Flag_overflow : 0;
+
+    return { .value = (uint16_t)((op == Op_CMP) ? a : value), .flags = flags };
+}
+
+Instruction ArithmeticInstruction(Operation op, bool wide)
+{
+    uint8_t part = wide ? FULL_BITS : LO_BITS;
+    Instruction inst = {
+        .op = op,
+        .size = 2,
+        .flags = (uint16_t)(wide ? Flags::Wide : 0)
+    };
+
+    inst.operands[DEST] = { .type = OpType_register, .reg = { Register_a, part } };
+    if (op != Op_INC && op != Op_DEC && op != Op_NEG)
+    {
+        inst.operands[SRC] = { .type = OpType_register, .reg = { Register_b, part } };
+    }
+
+    return inst;
+}
+
+/**
+ * MOV CX, 50, then `blocks` copies of INC AX; JMP $+2, each its own block, looped CX times with DEC CX; JZ; JMP near.
+ */
+std::vector<uint8_t> BuildBlockChain(uint32_t blocks)
+{
+    std::vector<uint8_t> bytes = { 0xB9, 0x32, 0x00 };     // MOV CX, 50
+    for (uint32_t i = 0; i < blocks; i++)
+    {
+        bytes.insert(bytes.end(), { 0x40, 0xEB, 0x00 });   // INC AX; JMP $+2
+    }
+
+    bytes.insert(bytes.end(), { 0x49, 0x74, 0x03 });       // DEC CX; JZ end
+    int16_t back = (int16_t)(3 - (bytes.size() + 3));
+    bytes.insert(bytes.end(), { 0xE9, (uint8_t)back, (uint8_t)(back >> 8) });    // JMP to the first INC
+    return bytes;
+}
+
+void Test_BlockCache_CountsHitsAndStaysWithinBudget()
+{
+    const uint32_t blocks = 200;
+    const uint32_t iterations = 50;
+    std::vector<uint8_t> bytes = BuildBlockChain(blocks);
+
+    Program program = LoadTestImage(Sim, bytes);
+
+    // Plenty of room: every block is decoded once and reached through a link on every later iteration. The first INC is
+    // in the same block as MOV CX until the loop jumps back to it, so the one table hit is the block after it, which the
+    // new block has no link to yet. The last iteration leaves through JZ without a lookup of its own.
+    StartExecution(Sim, program);
+    ExecutionResult result = Run(Sim, program, EXECUTE_INSTRUCTION_LIMIT);
+    AssertEqual(result.stop, Stop_programEnd);
+    AssertEqual(Sim.cpu.registers[Register_a], blocks * iterations);
+
+    const BlockCacheStats &stats = Sim.blocks.stats;
+    uint64_t lookups = (uint64_t)(blocks + 1) * iterations + (iterations - 1);
+    AssertEqual(stats.hits + stats.misses + stats.chained, lookups);
+    AssertEqual(stats.misses, (uint64_t)blocks + 3);
+    AssertEqual(stats.hits, 1u);
+    AssertEqual(stats.evictions, 0u);
+    AssertEqual(stats.flushes, 0u);
+    AssertEqual(stats.translated, (uint64_t)blocks * 2 + 6);
+
+    // Room for two blocks at most: the pool keeps filling up and flushing, and the results don't change
+    size_t budget = BLOCK_CACHE_SLOTS * sizeof(CachedBlock) + 2 * BLOCK_MAX_INSTRUCTIONS * sizeof(Instruction);
+    InitBlockCache(Sim.blocks, budget);
+    StartExecution(Sim, program);
+    ExecutionResult constrained = Run(Sim, program, EXECUTE_INSTRUCTION_LIMIT);
+    AssertEqual(constrained.instructions, result.instructions);
+    AssertEqual(Sim.cpu.registers[Register_a], blocks * iterations);
+    AssertEqual(stats.hits + stats.misses + stats.chained, lookups);
+    AssertEqual(stats.flushes > 0, true);
+    AssertEqual(stats.evictions > 0, true);
+    AssertEqual(Sim.blocks.slots.size() * sizeof(CachedBlock) + Sim.blocks.instructions.size() * sizeof(Instruction) <= budget, true);
+
+    DisplaySuccessResult;
+}
+
+void Test_BlockCache_InvalidatesSelfModifiedCode()
+{
+    // Patches MOV AX's immediate from inside the block holding it, then stores AX to a page with no code on it
+    const uint8_t bytes[] = {
+        0xB9, 0x03, 0x00,                   // MOV CX, 3
+        0xB8, 0x01, 0x00,                   // MOV AX, 1
+        0xC6, 0x06, 0x04, 0x00, 0x07,       // MOV byte [4], 7
+        0x89, 0x06, 0x00, 0x80,             // MOV [0x8000], AX
+        0xE2, 0xF2                          // LOOP to MOV AX
+    };
+
+    Program program = LoadTestImage(Sim, bytes, sizeof(bytes));
+
+    // The block at MOV AX is patched and dropped on every pass, while the one at the store stays cached throughout
+    StartExecution(Sim, program);
+    ExecutionResult result = Run(Sim, program, EXECUTE_INSTRUCTION_LIMIT);
+    AssertEqual(result.stop, Stop_programEnd);
+    AssertEqual(result.instructions, 13u);
+    AssertEqual(Sim.cpu.registers[Register_a], 7);
+
+    const BlockCacheStats &stats = Sim.blocks.stats;
+    AssertEqual(stats.invalidations, 3u);
+    AssertEqual(stats.hits, 2u);
+    AssertEqual(stats.misses, 4u);
+    AssertEqual(IsCodePage(Sim.blocks, 0x0000), true);
+    AssertEqual(IsCodePage(Sim.blocks, 0x8000), false);
+
+    // The fixtures write into their own code too, and must run the same with and without the cache
+    for (const std::string &fixture : FixtureFiles())
+    {
+        ExecutionResult results[2] = {};
+        CPU states[2] = {};
+        for (bool cached : { false, true })
+        {
+            Program fixtureProgram = LoadProgramIntoMemory(Sim, fixture);
+            StartExecution(Sim, fixtureProgram);
+            results[cached] = Run(Sim, fixtureProgram, 100000, Dispatch_threaded, cached);
+            MaterializeFlags(Sim.cpu);
+            states[cached] = Sim.cpu;
+        }
+
+        AssertEqual(results[true].instructions, results[false].instructions);
+        AssertEqual(results[true].stop, results[false].stop);
+        AssertEqual(memcmp(states[true].registers, states[false].registers, sizeof(states[true].registers)), 0);
+        AssertEqual(states[true].IP, states[false].IP);
+        AssertEqual(states[true].flags, states[false].flags);
+    }
+
+    DisplaySuccessResult;
+}
+
+void Test_BlockCache_ChainsBlocksAndPredictsReturns()
+{
+    // Three passes through a PUSH/JMP/RET subroutine call, then one call whose return address is patched on the stack
+    const uint8_t bytes[] = {
+        0xB9, 0x03, 0x00,                   // MOV CX, 3
+        0xB8, 0x09, 0x00,                   // L1: MOV AX, 9
+        0x50,                               // PUSH AX
+        0xEB, 0x10,                         // JMP sub
+        0x47,                               // INC DI
+        0xE2, 0xF7,                         // LOOP L1
+        0x50,                               // PUSH AX
+        0x89, 0xE5,                         // MOV BP, SP
+        0xC7, 0x46, 0x00, 0x16, 0x00,       // MOV word [BP], 22
+        0xEB, 0x03,                         // JMP sub
+        0x4E,                               // DEC SI
+        0xEB, 0x01,                         // JMP end
+        0xC3                                // sub: RET
+    };
+
+    Program program = LoadTestImage(Sim, bytes, sizeof(bytes));
+
+    ExecutionResult results[2] = {};
+    CPU states[2] = {};
+    for (bool cached : { false, true })
+    {
+        StartExecution(Sim, program);
+        Sim.blocks.stats = {};
+        results[cached] = Run(Sim, program, EXECUTE_INSTRUCTION_LIMIT, Dispatch_threaded, cached);
+        states[cached] = Sim.cpu;
+
+        // Without the cache there is nothing to predict into, so RETs aren't tracked at all
+        AssertEqual(Sim.blocks.stats.returnHits + Sim.blocks.stats.returnMisses, cached ? 4u : 0u);
+    }
+
+    AssertEqual(results[true].stop, Stop_programEnd);
+    AssertEqual(results[true].instructions, 26u);
+    AssertEqual(results[true].instructions, results[false].instructions);
+    AssertEqual(memcmp(states[true].registers, states[false].registers, sizeof(states[true].registers)), 0);
+    AssertEqual(states[true].registers[Register_di], 3);
+    AssertEqual(states[true].registers[Register_si], 0xFFFF);
+
+    // The loop's second pass links LOOP to L1 and L1 to sub, and the third pass follows both links. The first RET lands
+    // on a block that isn't cached yet and the patched one lands somewhere other than the slot its PUSH predicted.
+    const BlockCacheStats &stats = Sim.blocks.stats;
+    AssertEqual(stats.chained, 2u);
+    AssertEqual(stats.returnHits, 2u);
+    AssertEqual(stats.returnMisses, 2u);
+
+    DisplaySuccessResult;
+}
+
+void Test_LazyFlags_MatchEagerComputation()
+{
+    const Operation ops[] = { Op_ADD, Op_ADC, Op_SUB, Op_SBB, Op_CMP, Op_INC, Op_DEC, Op_NEG };
+    CPU &cpu = Sim.cpu;
+    cpu = {};
+
+    // Every byte operand pair with CF clear and set, materializing after each instruction
+    for (Operation op : ops)
+    {
+        Instruction inst = ArithmeticInstruction(op, false);
+        for (uint32_t pair = 0; pair < 0x20000; pair++)
+        {
+            uint16_t a = pair & 0xFF;
+            uint16_t b = (pair >> 8) & 0xFF;
+            uint16_t before = (pair >> 16) ? Flag_carry : 0;
+
+            cpu.registers[Register_a] = a;
+            cpu.registers[Register_b] = b;
+            WriteFlags(cpu, before);
+            ExecuteInstruction(Sim, inst);
+
+            EagerResult expected = EagerArithmetic(op, a, b, before, false);
+            AssertEqual(cpu.registers[Register_a], expected.value);
+            AssertEqual(MaterializeFlags(cpu), expected.flags);
+        }
+    }
+
+    // Random chains of byte and word instructions, reading the flags only now and then so pending results get
+    // overwritten and INC/DEC have to carry CF over from a result that was never materialized
+    uint32_t seed = 0x1A2F;
+    auto next = [&seed]() {
+        seed = seed * 1103515245 + 12345;
+        return (uint16_t)(seed >> 16);
+    };
+
+    uint16_t expectedFlags = 0;
+    WriteFlags(cpu, expectedFlags);
+    for (int i = 0; i < 200000; i++)
+    {
+        Operation op = ops[next() % ArrayCount(ops)];
+        bool wide = next() & 1;
+        uint16_t a = next();
+        uint16_t b = (next() & 3) ? next() : a;     // Equal operands often enough to hit ZF
+
+        cpu.registers[Register_a] = a;
+        cpu.registers[Register_b] = b;
+        ExecuteInstruction(Sim, ArithmeticInstruction(op, wide));
+
+        EagerResult expected = EagerArithmetic(op, a, b, expectedFlags, wide);
+        expectedFlags = expected.flags;
+        AssertEqual(cpu.registers[Register_a] & (wide ? 0xFFFF : 0xFF), expected.value);
+        if (next() % 4 == 0)
+        {
+            AssertEqual(MaterializeFlags(cpu), expectedFlags);
+        }
+    }
+
+    AssertEqual(MaterializeFlags(cpu), expectedFlags);
+    cpu = {};
+    DisplaySuccessResult;
+}
+
+void Test_WriteInstruction_RendersListingIntoBuffer()
+{
+    const uint8_t bytes[] = {
+        0x01, 0x50, 0x05,               // ADD [BX + SI + 5], DX
+        0x81, 0x40, 0x11, 0x00, 0x04,   // ADD word [BX + SI + 17], 1024
+        0x8B, 0x56, 0xFE,               // MOV DX, [BP - 2]
+        0xEB, 0xF6,                     // JMP $-8
+        0xC2, 0x04, 0x00                // RET 4
+    };
+    memcpy(Sim.memory, bytes, sizeof(bytes));
+
+    static OutputWriter writer = {};
+    OpenOutput(writer, -1);
+
+    SegmentedAddress at = Create(0, 0);
+    while (at.offset < sizeof(bytes))
+    {
+        WriteInstruction(writer, SpecializedDecoders[LookupEntry(Sim, at)](Sim, at));
+    }
+
+    std::string_view expected =
+        "\tADD [BX + SI + 5], DX\n"
+        "\tADD word [BX + SI + 17], 1024\n"
+        "\tMOV DX, [BP - 2]\n"
+        "\tJMP $-8\n"
+        "\tRET 4\n";
+
+    AssertEqual(std::string_view(writer.buffer, writer.used), expected);
+    DisplaySuccessResult;
+}
 
 // void Test_IsBitsDefined_ReturnsFalseWhenNotDefined()
 // {
@@ -50,8 +1451,8 @@
 // void Test_GetNextByte_ReturnsByteAndIncrementsIP() 
 // {
     
-//     Memory[0] = 1;
-//     Memory[1] = 2;
+//     Sim.memory[0] = 1;
+//     Sim.memory[1] = 2;
 //     CPU cpu = {};
 
 //     uint8_t result = GetNextByte(cpu.IP);
@@ -65,9 +1466,9 @@
 
 // void Test_GetNextWord_ReturnsTwoBytesIncrementsIPByTwo()
 // {
-//     Memory[0] = 1;
-//     Memory[1] = 2;
-//     Memory[2] = 3;
+//     Sim.memory[0] = 1;
+//     Sim.memory[1] = 2;
+//     Sim.memory[2] = 3;
 //     CPU cpu = {};
 //     uint16_t exp = 0b001000000001;
     
@@ -102,8 +1503,8 @@
 
 // void Test_Decode_DecodesRegToRegMovSuccessfully()
 // {
-//     Memory[0] = 0x89;
-//     Memory[1] = 0xd8;
+//     Sim.memory[0] = 0x89;
+//     Sim.memory[1] = 0xd8;
 //     CPU cpu = {.IP = 1};
 //     Entry entry = InstructionTable[0];
 //     SegmentedAddress
@@ -118,9 +1519,190 @@
 // }
 
 
+/* Golden Tests */
+
+/**
+ * One fixture binary and the listing it must disassemble to, stored in tests/golden/<name>.asm exactly as
+ * `sim8086 -o` writes it.
+ */
+struct GoldenTest {
+    std::string name;
+    std::string binary;
+    std::string golden;
+    std::string failure;
+    double milliseconds;
+};
+
+std::string ReadTextFile(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+/**
+ * Describes the first line where two listings differ.
+ */
+std::string DescribeDifference(const std::string &expected, const std::string &actual)
+{
+    size_t line = 1;
+    size_t start = 0;
+    while (start < expected.size() && start < actual.size())
+    {
+        size_t expectedEnd = expected.find('\n', start);
+        size_t actualEnd = actual.find('\n', start);
+        std::string expectedLine = expected.substr(start, expectedEnd - start);
+        std::string actualLine = actual.substr(start, actualEnd - start);
+        if (expectedLine != actualLine || expectedEnd == std::string::npos || actualEnd == std::string::npos)
+        {
+            return "line " + std::to_string(line) + ": expected \"" + expectedLine + "\", got \"" + actualLine + "\"";
+        }
+
+        start = expectedEnd + 1;
+        line++;
+    }
+
+    return "line " + std::to_string(line) + ": " + (expected.size() > actual.size() ? "listing ends early" : "listing runs long");
+}
+
+void RunGoldenTest(Machine &machine, GoldenTest &test)
+{
+    auto begin = std::chrono::steady_clock::now();
+    test.failure.clear();
+
+    std::string expected = ReadTextFile(test.golden);
+    std::string actual;
+    std::unique_ptr<OutputWriter> output = std::make_unique<OutputWriter>();
+    OpenCapture(*output, &actual);
+
+    Program program = LoadProgramIntoMemory(machine, test.binary);
+    if (!program.loaded)
+    {
+        test.failure = "could not load " + test.binary;
+    }
+    else if (expected.empty())
+    {
+        test.failure = "missing golden listing " + test.golden;
+    }
+    else
+    {
+        WriteText(*output, "bits 16\n\n");
+        Disassemble(machine, program, *output);
+        if (actual != expected)
+        {
+            test.failure = DescribeDifference(expected, actual);
+        }
+    }
+
+    test.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+/**
+ * Disassembles every .bin fixture in tests in-process on a thread per core, each with its own machine, and diffs the
+ * listings against their goldens. Results are printed in name order with the time each test took.
+ */
+void RunGoldenTests()
+{
+    std::vector<GoldenTest> tests;
+    for (const std::string &file : FixtureFiles())
+    {
+        std::filesystem::path path(file);
+        std::string name = path.stem().string();
+        tests.push_back({
+            .name = name,
+            .binary = file,
+            .golden = (path.parent_path() / "golden" / (name + ".asm")).string(),
+            .failure = "not run"
+        });
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> workers;
+    size_t workerCount = std::min<size_t>(tests.size(), std::max(1u, std::thread::hardware_concurrency()));
+    for (size_t i = 0; i < workerCount; i++)
+    {
+        workers.emplace_back([&]() {
+            std::unique_ptr<Machine> machine = std::make_unique<Machine>();
+            if (!InitMachine(*machine))
+            {
+                return;
+            }
+
+            for (size_t index = next++; index < tests.size(); index = next++)
+            {
+                RunGoldenTest(*machine, tests[index]);
+            }
+
+            ReleaseMachine(*machine);
+        });
+    }
+
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+
+    double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+    for (const GoldenTest &test : tests)
+    {
+        if (test.failure.empty())
+        {
+            printf("Golden_%s..........SUCCESS (%.3f ms)\n", test.name.c_str(), test.milliseconds);
+        }
+        else
+        {
+            printf("Golden_%s..........FAIL (%s)\n", test.name.c_str(), test.failure.c_str());
+            FailureCount++;
+        }
+    }
+
+    printf("%zu golden tests on %zu threads in %.3f ms\n", tests.size(), workerCount, total);
+}
+
 int main(int argc, char* argv[]) {
     
     printf("-------- Test Resuts ---------\n\n");
+
+    if (!InitMachine(Sim))
+    {
+        printf("Could not allocate simulator memory\n");
+        return 1;
+    }
+
+    Test_LookupEntry_SelectsGroupEntryFromModRmReg();
+    Test_LookupEntry_MatchesCandidateWalk();
+    Test_SpecializedDecoders_MatchInterpretedDecode();
+    Test_ModRmTable_DescribesOperandForms();
+    Test_DecodeInstructionLength_MatchesDecodeForAllOpcodes();
+    Test_DecodeInstructionLength_MatchesDecodeOnFixtures();
+    Test_LoadProgramIntoMemory_PlacesImageAtLoadAddress();
+    Test_Disassemble_WalksImagesAcrossSegmentBoundaries();
+    Test_DisassembleRecursive_LabelsTargetsAndSkipsData();
+    Test_DisassembleRecursive_WrapsTargetsAndListsOverlaps();
+    Test_DisassembleParallel_MatchesSerialListing();
+    Test_RunBatch_MatchesPerFileListingsInOrder();
+    Test_Machines_RunConcurrentlyWithoutSharingState();
+    Test_LibraryApi_DecodesAndStepsImage();
+    Test_InstructionRing_StreamsMoreThanCapacityInOrder();
+    Test_PackedInstruction_RoundTripsEveryDecodableOffset();
+    Test_ExportColumns_RoundTripsSweepInstructions();
+    Test_GenerateStream_CoversEveryEntryAndModRmForm();
+    Test_EncodeInstruction_PicksShortestNasmForm();
+    Test_VerifyImage_ReencodesFixturesAndGeneratedStreams();
+    Test_Run_ExecutesArithmeticStackAndBranches();
+    Test_Run_IndirectJumpsFollowTheDecodedForm();
+    Test_Run_ResumesCachedBlockOnlyAtIP();
+    Test_Run_DispatchStrategiesAgreeOnFixtures();
+    Test_BlockCache_CountsHitsAndStaysWithinBudget();
+    Test_BlockCache_InvalidatesSelfModifiedCode();
+    Test_BlockCache_ChainsBlocksAndPredictsReturns();
+    Test_LazyFlags_MatchEagerComputation();
+    Test_WriteInstruction_RendersListingIntoBuffer();
+
+    printf("\n");
+    RunGoldenTests();
     
     // Test_IsBitsDefined_ReturnsFalseWhenNotDefined();
     // Test_IsBitsDefined_ReturnsTrueWhenDefined();
@@ -129,6 +1711,7 @@ int main(int argc, char* argv[]) {
     // Test_DecodeEffectiveAddrExpression_ReturnsBxPlusSi();
     // Test_Decode_DecodesRegToRegMovSuccessfully();
 
+    ReleaseMachine(Sim);
     printf("\n-------- End Tests --------\n");
-    return 0;
+    return FailureCount == 0 ? 0 : 1;
 }
@@ -3,7 +3,7 @@ from pathlib import Path
 
 TEST_ROOT_DIR = Path(__file__).parent
 
-TEST_BINARIES_DIR = f"{TEST_ROOT_DIR}/bin"
+TEST_BINARIES_DIR = f"{TEST_ROOT_DIR.parent}/tests"
 
 SIM_OUTPUT_ASM = f"{TEST_ROOT_DIR}/result.asm"
 SIM_OUTPUT_BIN = f"{TEST_ROOT_DIR}/result.bin"